@@ -9,505 +9,1493 @@
 #include <sstream>
 #include <iostream>
 #include <climits>
+#include <cmath>
+#include <ctime>
+#include <cstdlib>
+#include <cstdio>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#if defined(SCHEDULER_PROFILE) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#endif
 
 // Global Scheduler instance
 static Scheduler scheduler;
 
+#if defined(SCHEDULER_BENCH) || defined(SCHEDULER_PROFILE)
+// Every callback opens a CallbackTimer. SCHEDULER_BENCH adds up the host wall and CPU time
+// spent in the scheduler for make bench; SCHEDULER_PROFILE keeps a latency histogram per
+// callback. SimulationComplete reports both. Without either flag the timers compile away.
+typedef enum {
+    CALLBACK_INIT,
+    CALLBACK_NEW_TASK,
+    CALLBACK_TASK_COMPLETION,
+    CALLBACK_SCHEDULER_CHECK,
+    CALLBACK_SLA_WARNING,
+    CALLBACK_MEMORY_WARNING,
+    CALLBACK_MIGRATION_DONE,
+    CALLBACK_STATE_CHANGE,
+    CALLBACKS
+} Callback_t;
+#endif
+
+#ifdef SCHEDULER_BENCH
+static std::chrono::steady_clock::duration callbackWallTime(0);
+static std::clock_t callbackCPUTime = 0;
+#endif
+
+#ifdef SCHEDULER_PROFILE
+#if defined(__x86_64__) || defined(__i386__)
+static inline uint64_t ReadCycles() { return __rdtsc(); }
+#else
+static inline uint64_t ReadCycles() { return std::chrono::steady_clock::now().time_since_epoch().count(); }
+#endif
+
+static const char *CALLBACK_NAMES[CALLBACKS] = {
+    "InitScheduler", "HandleNewTask", "HandleTaskCompletion", "SchedulerCheck",
+    "SLAWarning", "MemoryWarning", "MigrationDone", "StateChangeComplete"
+};
+static const char *SIMULATOR_CALL_NAMES[SIMULATOR_CALLS] = {
+    "Machine_GetInfo", "VM_GetInfo", "Machine_SetCorePerformance", "VM_Migrate"
+};
+
+// Durations in cycles, bucket b counting those below 2^b (and at least 2^(b-1))
+struct LatencyHistogram_t {
+    std::array<uint64_t, 65> buckets{};
+    uint64_t calls = 0;
+    uint64_t total = 0;
+    uint64_t max = 0;
+    
+    void Record(uint64_t cycles) {
+        buckets[cycles == 0 ? 0 : 64 - __builtin_clzll(cycles)]++;
+        calls++;
+        total += cycles;
+        max = std::max(max, cycles);
+    }
+    // Upper bound of the bucket holding the given fraction of the calls, capped at the max
+    uint64_t Percentile(double fraction) const {
+        uint64_t seen = 0;
+        for (unsigned b = 0; b < buckets.size(); b++) {
+            seen += buckets[b];
+            if (seen >= fraction * calls) return b == 0 ? 0 : (b >= 64 ? max : std::min(uint64_t(1) << b, max));
+        }
+        return max;
+    }
+};
+
+static std::array<LatencyHistogram_t, CALLBACKS> callbackLatency;
+std::array<uint64_t, SIMULATOR_CALLS> simulatorCalls{};
+
+// The cycle counter is calibrated against the steady clock over the whole run
+static const uint64_t profileStartCycles = ReadCycles();
+static const std::chrono::steady_clock::time_point profileStart = std::chrono::steady_clock::now();
+
+static void ReportProfile() {
+    double elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - profileStart).count();
+    double nsPerCycle = elapsed > 0 ? elapsed / double(ReadCycles() - profileStartCycles) : 1.0;
+    
+    cout << "Scheduler profile (ns; percentiles are log2 bucket upper bounds)" << endl;
+    cout << std::left << std::setw(22) << "callback" << std::right << std::setw(10) << "calls" << std::setw(12) << "mean"
+         << std::setw(12) << "p50" << std::setw(12) << "p99" << std::setw(12) << "max" << std::setw(14) << "total" << endl;
+    for (unsigned cb = 0; cb < CALLBACKS; cb++) {
+        const LatencyHistogram_t &h = callbackLatency[cb];
+        if (h.calls == 0) continue;
+        cout << std::left << std::setw(22) << CALLBACK_NAMES[cb] << std::right << std::setw(10) << h.calls << std::fixed << std::setprecision(0)
+             << std::setw(12) << h.total * nsPerCycle / h.calls << std::setw(12) << h.Percentile(0.5) * nsPerCycle
+             << std::setw(12) << h.Percentile(0.99) * nsPerCycle << std::setw(12) << h.max * nsPerCycle
+             << std::setw(14) << h.total * nsPerCycle << endl;
+    }
+    cout << "Histograms (cycles below 2^b: calls)" << endl;
+    for (unsigned cb = 0; cb < CALLBACKS; cb++) {
+        const LatencyHistogram_t &h = callbackLatency[cb];
+        if (h.calls == 0) continue;
+        cout << "  " << CALLBACK_NAMES[cb] << ":";
+        for (unsigned b = 0; b < h.buckets.size(); b++) {
+            if (h.buckets[b] > 0) cout << " 2^" << b << ":" << h.buckets[b];
+        }
+        cout << endl;
+    }
+    cout << "Simulator calls" << endl;
+    for (unsigned call = 0; call < SIMULATOR_CALLS; call++) {
+        cout << "  " << std::left << std::setw(28) << SIMULATOR_CALL_NAMES[call] << std::right << simulatorCalls[call] << endl;
+    }
+    cout.unsetf(std::ios_base::floatfield);
+}
+#endif
+
+#if defined(SCHEDULER_BENCH) || defined(SCHEDULER_PROFILE)
+struct CallbackTimer {
+#ifdef SCHEDULER_BENCH
+    std::chrono::steady_clock::time_point wallStart = std::chrono::steady_clock::now();
+    std::clock_t cpuStart = std::clock();
+#endif
+#ifdef SCHEDULER_PROFILE
+    Callback_t callback;
+    uint64_t cyclesStart;
+#endif
+    explicit CallbackTimer(Callback_t callback) {
+#ifdef SCHEDULER_PROFILE
+        this->callback = callback;
+        cyclesStart = ReadCycles();
+#endif
+    }
+    ~CallbackTimer() {
+#ifdef SCHEDULER_PROFILE
+        callbackLatency[callback].Record(ReadCycles() - cyclesStart);
+#endif
+#ifdef SCHEDULER_BENCH
+        callbackWallTime += std::chrono::steady_clock::now() - wallStart;
+        callbackCPUTime += std::clock() - cpuStart;
+#endif
+    }
+};
+#define TIME_CALLBACK(callback) CallbackTimer callbackTimer(callback)
+#else
+#define TIME_CALLBACK(callback)
+#endif
+
+// Overrides one tunable from the environment, keeping the default when the variable is
+// unset or does not parse
+template <typename T>
+static void ReadParam(const char *name, T &value) {
+    const char *text = std::getenv(name);
+    if (text == nullptr || *text == '\0') return;
+    std::istringstream in(text);
+    T parsed;
+    if (in >> parsed && in.eof()) {
+        value = parsed;
+    } else {
+        SCHED_LOG(1, string("Scheduler::Init(): ignoring ") + name + "=" + text);
+    }
+}
+
+// The simulator keeps its verbosity to itself, so it is read back from the command line
+// (simulator [-v level] input_file). Where that fails every message goes to SimOutput.
+unsigned logVerbosity = UINT_MAX;
+
+static unsigned ReadVerbosity() {
+    std::ifstream in("/proc/self/cmdline");
+    std::vector<string> args;
+    for (string arg; std::getline(in, arg, '\0'); ) args.push_back(arg);
+    if (args.empty()) return UINT_MAX;
+    if (args.size() != 4) return 0;
+    std::istringstream level(args[2]);
+    unsigned verbosity;
+    return args[1] == "-v" && level >> verbosity ? verbosity : UINT_MAX;
+}
+
+bool EventLog::Open(const string &file, bool append) {
+    Close();
+    fd = open(file.c_str(), O_WRONLY | O_CREAT | (append ? O_APPEND : O_TRUNC), 0644);
+    if (fd < 0) return false;
+    filling.reserve(BUFFER_RECORDS);
+    writing.reserve(BUFFER_RECORDS);
+    writePending = false;
+    stopping = false;
+    writer = std::thread(&EventLog::Write, this);
+    return true;
+}
+
+void EventLog::HandOff() {
+    std::unique_lock<std::mutex> guard(lock);
+    wake.wait(guard, [this] { return !writePending; });
+    filling.swap(writing);
+    writePending = true;
+    wake.notify_all();
+}
+
+void EventLog::Write() {
+    std::unique_lock<std::mutex> guard(lock);
+    while (true) {
+        wake.wait(guard, [this] { return writePending || stopping; });
+        if (!writePending) return;
+        guard.unlock();
+        // A failed write loses the rest of the buffer rather than stalling the simulation
+        const char *data = reinterpret_cast<const char *>(writing.data());
+        size_t left = writing.size() * sizeof(EventRecord_t);
+        while (left > 0) {
+            ssize_t written = write(fd, data, left);
+            if (written <= 0) break;
+            data += written;
+            left -= size_t(written);
+        }
+        writing.clear();
+        guard.lock();
+        writePending = false;
+        wake.notify_all();
+    }
+}
+
+void EventLog::Close() {
+    if (fd < 0) return;
+    if (!filling.empty()) HandOff();
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    writer.join();
+    close(fd);
+    fd = -1;
+}
+
 void Scheduler::Init() {
-    migratingVMs.clear();
+    logVerbosity = ReadVerbosity();
+    ReadParam("SCHEDULER_UNDERLOAD", params.underloadThreshold);
+    ReadParam("SCHEDULER_OVERLOAD", params.overloadThreshold);
+    ReadParam("SCHEDULER_CONSOLIDATION_START", params.consolidationStart);
+    SCHED_LOG(1, "Scheduler::Init(): underload " + to_string(params.underloadThreshold) + ", overload " +
+                 to_string(params.overloadThreshold) + ", consolidation from " + to_string(params.consolidationStart));
+    
+    const char *file = std::getenv("SCHEDULER_SAMPLE_FILE");
+    if (file != nullptr && *file != '\0') {
+        sampleFile = file;
+        sampleInterval = DEFAULT_SAMPLE_INTERVAL;
+        ReadParam("SCHEDULER_SAMPLE_INTERVAL", sampleInterval);
+        samples.open(sampleFile);
+        if (!samples || sampleInterval == 0) {
+            SCHED_LOG(0, "Scheduler::Init(): not sampling energy to " + sampleFile);
+            samples.close();
+            sampleInterval = 0;
+        } else {
+            samples << "time_us,machine,s_state,p_state,tasks,utilization,energy\n";
+        }
+    }
+    
+    const char *log = std::getenv("SCHEDULER_EVENT_LOG");
+    if (log != nullptr && *log != '\0') {
+        eventFile = log;
+        if (events.Open(eventFile, false)) {
+            LogEvent(EVENT_LOG_START, EVENT_LOG_VERSION, sizeof(EventRecord_t));
+        } else {
+            SCHED_LOG(0, "Scheduler::Init(): not logging events to " + eventFile);
+        }
+    }
+    
+    // Variants with no fork point fork on the first tick; a fork point with no variants is ignored
+    const char *variants = std::getenv("SCHEDULER_FORK_VARIANTS");
+    if (variants != nullptr && *variants != '\0') {
+        forkVariants = variants;
+        forkAt = DEFAULT_FORK_AT;
+        ReadParam("SCHEDULER_FORK_AT", forkAt);
+        const char *output = std::getenv("SCHEDULER_FORK_OUTPUT");
+        forkOutput = output != nullptr && *output != '\0' ? output : "fork";
+        SCHED_LOG(1, "Scheduler::Init(): forking " + forkVariants + " at " + to_string(forkAt));
+    } else if (std::getenv("SCHEDULER_FORK_AT") != nullptr) {
+        SCHED_LOG(0, "Scheduler::Init(): SCHEDULER_FORK_AT without SCHEDULER_FORK_VARIANTS, not forking");
+    }
+    
     unsigned totalMachines = Machine_GetTotal();
     std::map<CPUType_t, std::vector<MachineId_t>> machinesByCPU;
     
+    machineUtilization.assign(totalMachines, 0.0);
+    machineActive.assign(totalMachines, false);
+    vmsOnMachine.assign(totalMachines, std::set<VMId_t>());
+    machineSLACount.assign(totalMachines, SLACount_t());
+    machineMemory.assign(totalMachines, 0);
+    machineSettled.assign(totalMachines, true);
+    idleSince.assign(totalMachines, NOT_IDLE);
+    powerCheckAt.assign(totalMachines, NOT_IDLE);
+    wakeRequestedAt.assign(totalMachines, NOT_IDLE);
+    wakeFrom.assign(totalMachines, S0);
+    machineDraining.assign(totalMachines, false);
+    inboundMigrations.assign(totalMachines, 0);
+    pendingPState.assign(totalMachines, P_UNKNOWN);
+    riskParked.assign(totalMachines, std::vector<TaskId_t>());
+    machineDirty.assign(totalMachines, false);
+    
     // Categorize machines by CPU type
     for (unsigned i = 0; i < totalMachines; i++) {
         MachineId_t machineId = MachineId_t(i);
         machines.push_back(machineId);
+        COUNT_CALL(CALL_MACHINE_GET_INFO);
         MachineInfo_t info = Machine_GetInfo(machineId);
         CPUType_t cpuType = info.cpu;
         machinesByCPU[cpuType].push_back(machineId);
+        machinePools[cpuType].tiers[info.gpus].inactive.insert(std::make_pair(info.s_state, machineId));
+        machinePools[cpuType].wakeLatency = DEFAULT_WAKE_LATENCY;
+        machinePools[cpuType].peakMIPS = std::max(machinePools[cpuType].peakMIPS, double(info.performance[P0]));
+        machinePools[cpuType].largestMemory = std::max(machinePools[cpuType].largestMemory, info.memory_size);
+        machineSState.push_back(info.s_state);
+        machineSpecs.push_back(MachineSpec_t{info.num_cpus, info.cpu, info.memory_size, info.gpus,
+                                             info.performance, info.c_states, info.p_states, info.s_states});
+        if (machineSpecs.back().s_states.size() != S_STATES) machineSpecs.back().s_states = DEFAULT_S_STATE_POWER;
+        machinePState.push_back(info.p_state);
+        MarkDirty(machineId);
     }
     
     // Create VMs for each CPU type
     for (const auto &pair : machinesByCPU) {
         CPUType_t cpuType = pair.first;
-        const std::vector<MachineId_t> &machinesWithCPU = pair.second;
-        if (machinesWithCPU.empty()) continue;
+        if (pair.second.empty()) continue;
+        
+        // Alternate GPU and non-GPU machines so both tiers start with capacity
+        std::vector<MachineId_t> machinesWithCPU, byTier[2];
+        for (MachineId_t machine : pair.second) byTier[MachineHasGPU(machine)].push_back(machine);
+        for (size_t i = 0; machinesWithCPU.size() < pair.second.size(); i++) {
+            if (i < byTier[true].size()) machinesWithCPU.push_back(byTier[true][i]);
+            if (i < byTier[false].size()) machinesWithCPU.push_back(byTier[false][i]);
+        }
         
         unsigned numVMsToCreate = std::min(static_cast<unsigned>(machinesWithCPU.size()), 4u);
         for (unsigned i = 0; i < numVMsToCreate; i++) {
-            VMId_t vm = VM_Create(LINUX, cpuType);
-            vms.push_back(vm);
             MachineId_t machine = machinesWithCPU[i % machinesWithCPU.size()];
-            VM_Attach(vm, machine);
-            activeMachines.insert(machine);
-            machineUtilization[machine] = 0.0;
+            CreateVM(LINUX, cpuType, machine);
+            ActivateMachine(machine);
         }
     }
     
-    // Power down unused machines
+    // Power down unused machines, keeping the first few of each CPU type on standby
+    std::map<CPUType_t, unsigned> standby;
     for (MachineId_t machine : machines) {
-        if (activeMachines.find(machine) == activeMachines.end()) 
-            Machine_SetState(machine, S5);
+        if (IsMachineActive(machine)) continue;
+        SetMachineState(machine, standby[GetMachineCPU(machine)]++ < STANDBY_SPARES ? STANDBY_STATE : SPARE_STATE);
     }
 }
 
-bool Scheduler::SafeRemoveTask(VMId_t vm, TaskId_t task) {
-    if (IsVMMigrating(vm)) return false;
-    try {
-        VMInfo_t info = VM_GetInfo(vm);
-        for (TaskId_t t : info.active_tasks) {
-            if (t == task) {
-                VM_RemoveTask(vm, task);
-                return true;
-            }
+void Scheduler::ActivateMachine(MachineId_t machine) {
+    MachineTier_t &tier = TierOf(machine);
+    if (!machineActive[machine]) {
+        machineActive[machine] = true;
+        tier.inactive.erase(std::make_pair(machineSState[machine], machine));
+        tier.active.insert(machine);
+        tier.byUtilization.insert(std::make_pair(machineUtilization[machine], machine));
+        machinePools[GetMachineCPU(machine)].active.insert(machine);
+    }
+}
+
+void Scheduler::DeactivateMachine(MachineId_t machine) {
+    if (!machineActive[machine]) return;
+    machineActive[machine] = false;
+    
+    MachineTier_t &tier = TierOf(machine);
+    tier.byUtilization.erase(std::make_pair(machineUtilization[machine], machine));
+    tier.active.erase(machine);
+    tier.inactive.insert(std::make_pair(machineSState[machine], machine));
+    machinePools[GetMachineCPU(machine)].active.erase(machine);
+}
+
+void Scheduler::UpdateUtilization(MachineId_t machine) {
+    MarkDirty(machine);
+    unsigned cores = GetMachineCores(machine);
+    double utilization = 0.0;
+    if (cores > 0)
+        utilization = static_cast<double>(GetMachineTaskCount(machine)) / cores;
+    if (utilization == machineUtilization[machine]) return;
+    
+    if (IsMachineActive(machine) && !IsMachineDraining(machine)) {
+        MachineTier_t &tier = TierOf(machine);
+        tier.byUtilization.erase(std::make_pair(machineUtilization[machine], machine));
+        tier.byUtilization.insert(std::make_pair(utilization, machine));
+    }
+    machineUtilization[machine] = utilization;
+}
+
+MachineId_t Scheduler::NextMachineToWake(CPUType_t cpu, bool gpu) const {
+    auto it = machinePools.find(cpu);
+    if (it == machinePools.end() || it->second.tiers[gpu].inactive.empty()) return MachineId_t(-1);
+    return it->second.tiers[gpu].inactive.begin()->second;
+}
+
+MachineId_t Scheduler::NextMachineToWake(CPUType_t cpu) const {
+    auto it = machinePools.find(cpu);
+    if (it == machinePools.end()) return MachineId_t(-1);
+    std::pair<MachineState_t, MachineId_t> next(S5, MachineId_t(-1));
+    for (const MachineTier_t &tier : it->second.tiers) {
+        if (!tier.inactive.empty()) next = std::min(next, *tier.inactive.begin());
+    }
+    return next.second;
+}
+
+MachineId_t Scheduler::NextMachineToWake() const {
+    std::pair<MachineState_t, MachineId_t> next(S5, MachineId_t(-1));
+    for (const auto &pair : machinePools) {
+        for (const MachineTier_t &tier : pair.second.tiers) {
+            if (!tier.inactive.empty()) next = std::min(next, *tier.inactive.begin());
         }
-        return false;
-    } 
-    catch (...) {
-        return false;
     }
+    return next.second;
 }
 
-void Scheduler::NewTask(Time_t now, TaskId_t task_id) {
-    CPUType_t required_cpu = RequiredCPUType(task_id);
-    VMType_t required_vm = RequiredVMType(task_id);
-    SLAType_t sla_type = RequiredSLA(task_id);
+VMId_t Scheduler::CreateVM(VMType_t vm_type, CPUType_t cpu, MachineId_t machine) {
+    VMId_t vm = VM_Create(vm_type, cpu);
+    vms.push_back(vm);
+    if (vm >= vmHost.size()) {
+        vmHost.resize(vm + 1, MachineId_t(-1));
+        vmCPU.resize(vm + 1);
+        vmTasks.resize(vm + 1);
+        vmSLACount.resize(vm + 1, SLACount_t());
+        vmMemory.resize(vm + 1, 0);
+        vmMigrating.resize(vm + 1, false);
+        vmDestination.resize(vm + 1, MachineId_t(-1));
+        vmMigratedAt.resize(vm + 1, NOT_IDLE);
+        vmType.resize(vm + 1);
+        vmIdleSince.resize(vm + 1, NOT_IDLE);
+    }
+    vmCPU[vm] = cpu;
+    vmType[vm] = vm_type;
+    vmMemory[vm] = VM_MEMORY_OVERHEAD;
+    vmPools[std::make_pair(cpu, vm_type)].insert(vm);
+    AttachVM(vm, machine);
+    LogEvent(EVENT_VM_CREATED, vm, machine, vm_type);
+    return vm;
+}
+
+void Scheduler::RetireVM(VMId_t vm) {
+    VM_Shutdown(vm);
+    LogEvent(EVENT_VM_RETIRED, vm, vmHost[vm]);
+    vms.erase(std::find(vms.begin(), vms.end(), vm));
+    vmPools[std::make_pair(vmCPU[vm], vmType[vm])].erase(vm);
+    vmsOnMachine[vmHost[vm]].erase(vm);
+    machineMemory[vmHost[vm]] -= vmMemory[vm];
+    vmHost[vm] = MachineId_t(-1);
+}
+
+void Scheduler::SetMachineState(MachineId_t machine, MachineState_t s_state) {
+    // The simulator completes overlapping requests out of order and leaves the machine in
+    // whichever finished last, so a request made mid-transition is held until it reports back
+    if (machineSettled[machine]) Machine_SetState(machine, s_state);
+    LogEvent(EVENT_S_STATE_REQUESTED, machine, s_state);
+    if (!machineActive[machine]) {
+        MachineTier_t &tier = TierOf(machine);
+        tier.inactive.erase(std::make_pair(machineSState[machine], machine));
+        tier.inactive.insert(std::make_pair(s_state, machine));
+    }
+    if (s_state == S0 && machineSState[machine] != S0) {
+        wakeRequestedAt[machine] = Now();
+        wakeFrom[machine] = machineSState[machine];
+    }
+    machineSState[machine] = s_state;
+    machineSettled[machine] = false;
+    idleSince[machine] = NOT_IDLE;
+    // The cores' P-state is not known across a power transition, so the next request is always issued
+    machinePState[machine] = P_UNKNOWN;
+    MarkDirty(machine);
+}
+
+void Scheduler::ConfirmMachineState(MachineId_t machine, MachineState_t s_state, Time_t now) {
+    // The request was superseded while in flight: issue the one that was held back
+    if (s_state != machineSState[machine]) {
+        Machine_SetState(machine, machineSState[machine]);
+        return;
+    }
+    machineSettled[machine] = true;
+    idleSince[machine] = now;
+    MarkDirty(machine);
+    LogEvent(EVENT_S_STATE_CONFIRMED, machine, s_state);
     
-    Priority_t priority;
-    switch (sla_type) {
+    if (s_state == S0 && wakeRequestedAt[machine] != NOT_IDLE) {
+        double &latency = machinePools[GetMachineCPU(machine)].wakeLatency[wakeFrom[machine]];
+        latency += WAKE_LATENCY_WEIGHT * (double(now - wakeRequestedAt[machine]) - latency);
+        wakeRequestedAt[machine] = NOT_IDLE;
+    }
+}
+
+void Scheduler::DrainMachine(MachineId_t machine) {
+    // Still powered and listed as active, but no longer offered to placement
+    MachineTier_t &tier = TierOf(machine);
+    tier.byUtilization.erase(std::make_pair(machineUtilization[machine], machine));
+    tier.active.erase(machine);
+    machinePools[GetMachineCPU(machine)].active.erase(machine);
+    machineDraining[machine] = true;
+}
+
+void Scheduler::SleepMachine(MachineId_t machine) {
+    machineDraining[machine] = false;
+    DeactivateMachine(machine);
+    SetMachineState(machine, DRAINED_STATE);
+}
+
+void Scheduler::SetMachinePerformance(MachineId_t machine, CPUPerformance_t p_state) {
+    if (pendingPState[machine] == P_UNKNOWN) pendingPMachines.push_back(machine);
+    pendingPState[machine] = p_state;
+}
+
+void Scheduler::FlushPerformance() {
+    // Only the last request per machine survives, and only real changes reach the simulator
+    for (MachineId_t machine : pendingPMachines) {
+        CPUPerformance_t p_state = pendingPState[machine];
+        pendingPState[machine] = P_UNKNOWN;
+        if (p_state == machinePState[machine]) continue;
+        
+        for (unsigned i = 0; i < GetMachineCores(machine); i++) {
+            COUNT_CALL(CALL_MACHINE_SET_CORE_PERFORMANCE);
+            Machine_SetCorePerformance(machine, i, p_state);
+        }
+        machinePState[machine] = p_state;
+        MarkDirty(machine);
+        LogEvent(EVENT_P_STATE_SET, machine, p_state);
+    }
+    pendingPMachines.clear();
+}
+
+// The priority a task of each SLA class is placed with
+static Priority_t SLAPriority(SLAType_t sla) {
+    switch (sla) {
     case SLA0:
-        priority = HIGH_PRIORITY;
-        break;
+        return HIGH_PRIORITY;
     case SLA1:
-        priority = MID_PRIORITY;
-        break;
     case SLA2:
-        priority = MID_PRIORITY;
-        break;
+        return MID_PRIORITY;
     case SLA3:
     default:
-        priority = LOW_PRIORITY;
-        break;
+        return LOW_PRIORITY;
     }
+}
+
+void Scheduler::YieldToTask(VMId_t vm, TaskId_t task) {
+    // Tasks already at LOW_PRIORITY, escalated or yielding to another task are left as they are
+    for (TaskId_t other : vmTasks[vm]) {
+        TaskState_t &state = liveTasks.at(other);
+        if (other == task || state.priority == LOW_PRIORITY || state.priority != SLAPriority(state.sla)) continue;
+        state.yieldingTo = task;
+        SetPriority(other, LOW_PRIORITY);
+    }
+}
+
+void Scheduler::ForgetTask(VMId_t vm, TaskId_t task) {
+    std::vector<TaskId_t> &tasks = vmTasks[vm];
+    tasks.erase(std::find(tasks.begin(), tasks.end(), task));
     
-    VMId_t target_vm = VMId_t(-1);
-    
-    // For SLA0 tasks, try to find a VM with only SLA0 tasks or no tasks
-    if (sla_type == SLA0) {
-        for (VMId_t vm : vms) {
-            if (IsVMMigrating(vm)) continue;
-            
-            VMInfo_t info = VM_GetInfo(vm);
-            if (info.cpu != required_cpu) continue;
-            
-            // Check if VM has only SLA0 tasks
-            bool onlySLA0Tasks = true;
-            for (TaskId_t existingTask : info.active_tasks) {
-                if (RequiredSLA(existingTask) != SLA0) {
-                    onlySLA0Tasks = false;
-                    break;
-                }
-            }
-            
-            if (onlySLA0Tasks) {
-                // Prefer VMs with fewer tasks
-                if (target_vm == VMId_t(-1) || info.active_tasks.size() < VM_GetInfo(target_vm).active_tasks.size()) {
-                    target_vm = vm;
-                }
-            }
-        }
+    // The tasks that yielded to this one get their SLA's priority back, unless raised since
+    for (TaskId_t other : tasks) {
+        TaskState_t &state = liveTasks.at(other);
+        if (state.yieldingTo != task) continue;
+        state.yieldingTo = NO_TASK;
+        if (state.priority == LOW_PRIORITY) SetPriority(other, SLAPriority(state.sla));
     }
+    auto it = liveTasks.find(task);
+    CountTask(vm, it->second.sla, -1);
+    ReserveMemory(vm, -int(it->second.memory));
+    liveTasks.erase(it);
+}
+
+void Scheduler::CountTask(VMId_t vm, SLAType_t sla, int delta) {
+    SLACount_t &vmCount = vmSLACount[vm];
+    SLACount_t &machineCount = machineSLACount[vmHost[vm]];
+    vmCount[sla] += delta;
+    machineCount[sla] += delta;
+    UpdateUtilization(vmHost[vm]);
+}
+
+void Scheduler::ReserveMemory(VMId_t vm, int delta) {
+    vmMemory[vm] += delta;
+    machineMemory[vmHost[vm]] += delta;
+    if (IsVMMigrating(vm)) machineMemory[vmDestination[vm]] += delta;
+}
+
+double Scheduler::Headroom(MachineId_t machine, unsigned memory) const {
+    double slots = params.overloadThreshold * GetMachineCores(machine);
+    double cpu = slots > 0 ? (slots - GetMachineTaskCount(machine) - 1) / slots : -1.0;
+    double size = machineSpecs[machine].memory_size;
+    double mem = size > 0 ? (size - GetMachineMemory(machine) - memory) / size : -1.0;
+    return std::min(cpu, mem);
+}
+
+void Scheduler::NewTask(Time_t now, TaskId_t task_id) {
+    TaskInfo_t info = GetTaskInfo(task_id);
+    CPUType_t required_cpu = info.required_cpu;
+    machinePools[required_cpu].arrivals[std::make_pair(info.required_sla, info.required_vm)].count++;
+    if (PlaceTask(info)) return;
     
-    // If no dedicated VM found for SLA0 or for other SLA types, use regular approach
-    if (target_vm == VMId_t(-1)) {
-        unsigned lowest_task_count = UINT_MAX;
-        for (VMId_t vm : vms) {
-            if (IsVMMigrating(vm)) continue;
-            
-            VMInfo_t info = VM_GetInfo(vm);
-            if (info.cpu == required_cpu) {
-                if (sla_type == SLA0) {
-                    if (info.active_tasks.size() < lowest_task_count) {
-                        lowest_task_count = info.active_tasks.size();
-                        target_vm = vm;
-                    }
-                } else {
-                    target_vm = vm;
-                    break;
-                }
-            }
+    // No VM can take the task right now: park it until capacity of its CPU type is ready,
+    // waking a machine unless one is already on its way up. A CPU type the cluster does not
+    // have can never take it.
+    MachinePool_t &pool = machinePools[required_cpu];
+    if (pool.active.empty() && NextMachineToWake(required_cpu) == MachineId_t(-1)) return;
+    Time_t runtime = pool.peakMIPS > 0 ? Time_t(info.total_instructions / pool.peakMIPS) : 0;
+    Time_t latestStart = info.target_completion > runtime ? info.target_completion - runtime : 0;
+    pool.pending.push(std::make_pair(latestStart, task_id));
+    LogEvent(EVENT_TASK_PENDING, task_id, required_cpu);
+    
+    for (MachineId_t machine : pool.active) {
+        if (!IsMachineAwake(machine)) return;
+    }
+    bool preferGPU = info.gpu_capable;
+    MachineId_t machine = NextMachineToWake(required_cpu, preferGPU);
+    if (machine == MachineId_t(-1)) machine = NextMachineToWake(required_cpu, !preferGPU);
+    if (machine != MachineId_t(-1)) {
+        SetMachineState(machine, S0);
+        ActivateMachine(machine);
+    }
+}
+
+void Scheduler::AdmitPending(CPUType_t cpu) {
+    // Most urgent first; stop at the first task that still finds no room. A task too big for
+    // every machine will not find more room later, so it is set aside rather than holding up
+    // the tasks behind it.
+    TaskQueue_t &pending = machinePools[cpu].pending;
+    std::vector<std::pair<Time_t, TaskId_t>> oversized;
+    while (!pending.empty()) {
+        TaskInfo_t info = GetTaskInfo(pending.top().second);
+        if (!PlaceTask(info)) {
+            if (CanEverFit(cpu, info.required_memory)) break;
+            oversized.push_back(pending.top());
         }
+        pending.pop();
     }
+    for (const std::pair<Time_t, TaskId_t> &entry : oversized) pending.push(entry);
+}
+
+// The simulator only runs AIX VMs on POWER and WIN VMs on ARM and X86; tasks asking for
+// either elsewhere run in a LINUX VM, as they always have
+static VMType_t HostableVMType(VMType_t vm_type, CPUType_t cpu) {
+    if (vm_type == AIX && cpu != POWER) return LINUX;
+    if (vm_type == WIN && (cpu == POWER || cpu == RISCV)) return LINUX;
+    return vm_type;
+}
+
+const std::set<VMId_t>* Scheduler::GetVMPool(CPUType_t cpu, VMType_t vm_type) const {
+    auto it = vmPools.find(std::make_pair(cpu, vm_type));
+    return it == vmPools.end() ? nullptr : &it->second;
+}
+
+const MachineTier_t* Scheduler::GetTier(CPUType_t cpu, bool gpu) const {
+    auto it = machinePools.find(cpu);
+    return it == machinePools.end() ? nullptr : &it->second.tiers[gpu];
+}
+
+bool Scheduler::PlaceTask(const TaskInfo_t &info) {
+    CPUType_t required_cpu = info.required_cpu;
+    VMType_t required_vm = HostableVMType(info.required_vm, required_cpu);
+    SLAType_t sla_type = info.required_sla;
+    // A task no machine of its CPU type could ever hold would wait forever for a
+    // reservation; it is placed as if it needed no memory and overcommits its host
+    unsigned memory = CanEverFit(required_cpu, info.required_memory) ? info.required_memory : 0;
     
-    // If still no suitable VM, create a new one
-    if (target_vm == VMId_t(-1)) {
-        MachineId_t target_machine = MachineId_t(-1);
-        
-        // For SLA0, try to find a machine with low utilization
-        if (sla_type == SLA0) {
-            double lowest_util = 1.0;
-            for (MachineId_t machine : activeMachines) {
-                MachineInfo_t info = Machine_GetInfo(machine);
-                if (info.cpu != required_cpu) continue;
-                
-                double util = machineUtilization[machine];
-                if (util < lowest_util) {
-                    lowest_util = util;
-                    target_machine = machine;
-                }
-            }
-        }
-        
-        // If no suitable machine found or not SLA0, use regular approach
-        if (target_machine == MachineId_t(-1)) {
-            for (MachineId_t machine : activeMachines) {
-                MachineInfo_t info = Machine_GetInfo(machine);
-                if (info.cpu == required_cpu) {
-                    target_machine = machine;
-                    break;
-                }
-            }
-        }
-        
-        // If still no suitable machine, power on a new one
-        if (target_machine == MachineId_t(-1)) {
-            for (MachineId_t machine : machines) {
-                if (activeMachines.find(machine) != activeMachines.end()) continue;
-                
-                MachineInfo_t info = Machine_GetInfo(machine);
-                if (info.cpu == required_cpu) {
-                    Machine_SetState(machine, S0);
-                    activeMachines.insert(machine);
-                    machineUtilization[machine] = 0.0;
-                    target_machine = machine;
-                    break;
-                }
-            }
-        }
-        
-        // Create a new VM on the target machine
-        if (target_machine != MachineId_t(-1)) {
-            target_vm = VM_Create(required_vm, required_cpu);
-            VM_Attach(target_vm, target_machine);
-            vms.push_back(target_vm);
+    Priority_t priority = SLAPriority(sla_type);
+    
+    // GPU-capable tasks look at GPU hosts first and all other tasks at non-GPU hosts first.
+    // A warm VM of the right type is preferred over a new one, and hosts within
+    // the overload threshold over overcommitting one. A task no host has the memory for waits.
+    bool preferGPU = info.gpu_capable;
+    VMId_t target_vm = VMId_t(-1);
+    for (bool withinCapacity : {true, false}) {
+        for (bool gpu : {preferGPU, !preferGPU}) {
+            target_vm = ActivePolicy::Placement::PickVM(*this, required_cpu, required_vm, sla_type, gpu, withinCapacity, memory);
+            if (target_vm != VMId_t(-1)) break;
+            
+            // Machines still waking up are not used
+            MachineId_t target_machine = ActivePolicy::Placement::PickHost(*this, required_cpu, sla_type, gpu, withinCapacity, memory);
+            if (target_machine == MachineId_t(-1)) continue;
+            target_vm = CreateVM(required_vm, required_cpu, target_machine);
             
             // For SLA0, set all cores to maximum performance immediately
             if (sla_type == SLA0) {
-                MachineInfo_t machineInfo = Machine_GetInfo(target_machine);
-                for (unsigned i = 0; i < machineInfo.num_cpus; i++) {
-                    Machine_SetCorePerformance(target_machine, i, P0);
-                }
+                SetMachinePerformance(target_machine, P0);
             }
+            break;
         }
+        if (target_vm != VMId_t(-1)) break;
     }
     
+    // Nothing ready in either tier; the caller parks the task instead
+    if (target_vm == VMId_t(-1)) return false;
+    
     // Assign task to VM
-    if (target_vm != VMId_t(-1)) {
-        if (IsVMMigrating(target_vm)) return;
-        VM_AddTask(target_vm, task_id, priority);
-    }
+    AddTask(target_vm, info, priority);
+    return true;
 }
 
-void Scheduler::OptimizeForSLA0Tasks() {
-    // Find all machines with SLA0 tasks
-    std::set<MachineId_t> machinesWithSLA0;
+void Scheduler::PeriodicCheck(Time_t now) {
+#ifdef SCHEDULER_DEBUG
+    VerifyUtilization(now);
+#endif
+    if (now >= forkAt) ForkVariants(now);
     
-    for (VMId_t vm : vms) {
-        if (IsVMMigrating(vm)) continue;
-        
-        VMInfo_t vmInfo = VM_GetInfo(vm);
-        bool hasSLA0 = false;
-        
-        for (TaskId_t task : vmInfo.active_tasks) {
-            if (RequiredSLA(task) == SLA0) {
-                hasSLA0 = true;
-                break;
+    // A machine nothing has touched since the last tick would get the P-state it already
+    // has, and its parked at-risk tasks the projection they already have
+    tickMachines.swap(dirtyMachines);
+    dirtyMachines.clear();
+    for (MachineId_t machine : tickMachines) {
+        machineDirty[machine] = false;
+        for (TaskId_t task : riskParked[machine]) TrackSLARisk(task, now);
+        riskParked[machine].clear();
+    }
+    
+    for (MachineId_t machine : tickMachines) SetMachinePerformance(machine, PlanPerformance(machine, now));
+    
+    // Catch SLA0-SLA2 tasks heading for a deadline miss before SLAWarning fires
+    MonitorSLATasks(now);
+    
+    // Completions free the cores and memory parked tasks wait for. They are admitted here
+    // rather than in TaskComplete: the simulator's CPU model fails when a task is attached
+    // while the machine is still retiring the one that finished.
+    for (auto &pair : machinePools) AdmitPending(pair.first);
+    
+    // Requests the policy doesn't act on are dropped, not carried to the next tick
+    ActivePolicy::Migration::Relieve(*this, now);
+    reliefRequests.clear();
+    ActivePolicy::Migration::Rebalance(*this, now);
+    ReclaimIdleVMs(now);
+    ActivePolicy::Power::Govern(*this, now);
+    ForecastDemand(now);
+    if (sampleInterval > 0 && now >= nextSampleAt) SampleEnergy(now);
+}
+
+void Scheduler::SampleEnergy(Time_t now) {
+    // The state columns are the scheduler's view: the last S-state and P-state requested,
+    // the P-state left empty across a power transition. Energy is in microjoules.
+    for (MachineId_t machine : machines) {
+        uint64_t energy = Machine_GetEnergy(machine);
+        samples << now << ',' << machine << ',' << machineSState[machine] << ',';
+        if (machinePState[machine] != P_UNKNOWN) samples << machinePState[machine];
+        samples << ',' << GetMachineTaskCount(machine) << ',' << machineUtilization[machine] << ',' << energy << '\n';
+    }
+    nextSampleAt = now + sampleInterval;
+}
+
+void Scheduler::ReclaimIdleVMs(Time_t now) {
+    // A VM only goes idle or busy along with a change to its host, so only the VMs on this
+    // tick's machines need their idle clock started or stopped
+    for (MachineId_t machine : tickMachines) {
+        for (VMId_t vm : vmsOnMachine[machine]) {
+            if (GetVMTaskCount(vm) > 0 || IsVMMigrating(vm)) {
+                vmIdleSince[vm] = NOT_IDLE;
+            } else if (vmIdleSince[vm] == NOT_IDLE) {
+                vmIdleSince[vm] = now;
+                vmReclaims.push(std::make_pair(now + VM_IDLE_TIMEOUT, vm));
             }
         }
-        
-        if (hasSLA0) {
-            machinesWithSLA0.insert(vmInfo.machine_id);
+    }
+    
+    // Timeouts come due in order; VMs retired or put back to work since are skipped
+    while (!vmReclaims.empty() && vmReclaims.top().first <= now) {
+        std::pair<Time_t, VMId_t> entry = vmReclaims.top();
+        vmReclaims.pop();
+        VMId_t vm = entry.second;
+        if (vmHost[vm] == MachineId_t(-1) || vmIdleSince[vm] == NOT_IDLE || vmIdleSince[vm] + VM_IDLE_TIMEOUT != entry.first) continue;
+        if (GetVMTaskCount(vm) > 0 || IsVMMigrating(vm)) {
+            vmIdleSince[vm] = NOT_IDLE;
+            continue;
         }
+        RetireVM(vm);
     }
+}
+
+static void UpdateRate(RateEstimate_t &estimate, Time_t elapsed, double levelWeight, double trendWeight) {
+    double level = estimate.level;
+    estimate.level += levelWeight * (double(estimate.count) / elapsed - estimate.level);
+    estimate.trend += trendWeight * ((estimate.level - level) / elapsed - estimate.trend);
+    estimate.count = 0;
+}
+
+void Scheduler::ForecastDemand(Time_t now) {
+    if (now < lastForecastAt + FORECAST_INTERVAL) return;
+    Time_t elapsed = now - lastForecastAt;
+    lastForecastAt = now;
     
-    // Set all cores to maximum performance on machines with SLA0 tasks
-    for (MachineId_t machine : machinesWithSLA0) {
-        MachineInfo_t info = Machine_GetInfo(machine);
+    for (auto &pair : machinePools) {
+        MachinePool_t &pool = pair.second;
+        double arrivalLevel = 0.0, arrivalTrend = 0.0;
+        for (auto &arrival : pool.arrivals) {
+            UpdateRate(arrival.second, elapsed, RATE_LEVEL_WEIGHT, RATE_TREND_WEIGHT);
+            arrivalLevel += arrival.second.level;
+            arrivalTrend += arrival.second.trend;
+        }
+        UpdateRate(pool.departures, elapsed, RATE_LEVEL_WEIGHT, RATE_TREND_WEIGHT);
+        
+        // Look as far ahead as the next machine to wake needs to come up
+        MachineId_t next = NextMachineToWake(pair.first);
+        if (next == MachineId_t(-1)) continue;
+        double horizon = pool.wakeLatency[machineSState[next]] + elapsed;
+        if (horizon > FORECAST_HORIZON_LIMIT) continue;
+        
+        // Net tasks added over the horizon, integrating the linear rate forecast
+        double growth = (arrivalLevel - pool.departures.level) * horizon +
+                        (arrivalTrend - pool.departures.trend) * horizon * horizon / 2;
+        if (growth <= 0.0) continue;
         
-        for (unsigned i = 0; i < info.num_cpus; i++) {
-            Machine_SetCorePerformance(machine, i, P0);
+        double tasks = 0.0, capacity = 0.0;
+        for (MachineId_t machine : pool.active) {
+            tasks += GetMachineTaskCount(machine);
+            capacity += params.overloadThreshold * GetMachineCores(machine);
+        }
+        
+        // Only the forecast increase is provisioned for; current overload is not the forecast's job
+        double shortfall = tasks + growth - std::max(capacity, tasks);
+        for (unsigned woken = 0; shortfall >= 1.0 && woken < FORECAST_MAX_WAKE; woken++) {
+            next = NextMachineToWake(pair.first);
+            if (next == MachineId_t(-1) || pool.wakeLatency[machineSState[next]] + elapsed > FORECAST_HORIZON_LIMIT) break;
+            shortfall -= params.overloadThreshold * GetMachineCores(next);
+            SetMachineState(next, S0);
+            ActivateMachine(next);
         }
     }
 }
 
-void Scheduler::PeriodicCheck(Time_t now) {
-    // Update machine utilization
-    for (MachineId_t machine : machines) {
-        MachineInfo_t info = Machine_GetInfo(machine);
-        double utilization = 0.0;
-        if (info.num_cpus > 0)
-            utilization = static_cast<double>(info.active_tasks) / info.num_cpus;
-        machineUtilization[machine] = utilization;
+void Scheduler::GovernPower(Time_t now) {
+    // A machine's idle state only changes with the machine, so the ones to look at are this
+    // tick's and those whose next step down the ladder has come due
+    powerDue.assign(tickMachines.begin(), tickMachines.end());
+    while (!powerChecks.empty() && powerChecks.top().first <= now) {
+        std::pair<Time_t, MachineId_t> entry = powerChecks.top();
+        powerChecks.pop();
+        if (powerCheckAt[entry.second] != entry.first) continue;
+        powerCheckAt[entry.second] = NOT_IDLE;
+        powerDue.push_back(entry.second);
     }
     
-    // Optimize for SLA0 tasks
-    OptimizeForSLA0Tasks();
-    
-    // Set performance states for machines without SLA0 tasks
-    for (MachineId_t machine : machines) {
-        MachineInfo_t info = Machine_GetInfo(machine);
+    for (MachineId_t machine : powerDue) {
+        if (!machineSettled[machine] || IsMachineDraining(machine)) continue;
+        MachineState_t state = machineSState[machine];
+        if (state == S0 && (GetMachineTaskCount(machine) > 0 || inboundMigrations[machine] > 0)) {
+            idleSince[machine] = NOT_IDLE;
+            continue;
+        }
+        if (idleSince[machine] == NOT_IDLE) idleSince[machine] = now;
         
-        // Check if this machine has any SLA0 tasks
-        bool hasSLA0 = false;
-        for (VMId_t vm : vms) {
-            if (IsVMMigrating(vm)) continue;
-            
-            VMInfo_t vmInfo = VM_GetInfo(vm);
-            if (vmInfo.machine_id != machine) continue;
-            
-            for (TaskId_t task : vmInfo.active_tasks) {
-                if (RequiredSLA(task) == SLA0) {
-                    hasSLA0 = true;
-                    break;
-                }
-            }
-            
-            if (hasSLA0) break;
+        // States are numbered by depth; one off the ladder steps down to the next rung
+        auto step = std::upper_bound(IDLE_LADDER.begin(), IDLE_LADDER.end(), state);
+        if (step == IDLE_LADDER.end()) continue;
+        MachineState_t next = *step;
+        
+        // Ski rental: go deeper once the power already spent idling here covers the energy
+        // of a full-power wake-up from the next state
+        const MachineSpec_t &spec = GetMachineSpec(machine);
+        MachinePool_t &pool = machinePools[spec.cpu];
+        if (spec.s_states[next] >= spec.s_states[state]) continue;
+        double breakEven = pool.wakeLatency[next] * spec.s_states[S0] / (spec.s_states[state] - spec.s_states[next]);
+        if (double(now - idleSince[machine]) < breakEven) {
+            SchedulePowerCheck(machine, idleSince[machine] + Time_t(std::ceil(breakEven)));
+            continue;
         }
         
-        // Only adjust performance for machines without SLA0 tasks
-        if (!hasSLA0) {
-            if (info.active_tasks > 0) {
-                for (unsigned i = 0; i < info.num_cpus; i++)
-                    Machine_SetCorePerformance(machine, i, P0);
-            } else {
-                for (unsigned i = 0; i < info.num_cpus; i++)
-                    Machine_SetCorePerformance(machine, i, P3);
+        if (state == S0) {
+            // Held back for the warm minimum until another machine of the pool is up
+            if (pool.active.size() <= MIN_WARM_MACHINES) {
+                SchedulePowerCheck(machine, now + 1);
+                continue;
             }
+            bool busy = false;
+            for (VMId_t vm : vmsOnMachine[machine]) busy = busy || IsVMMigrating(vm);
+            if (busy) continue;
+            std::vector<VMId_t> idle(vmsOnMachine[machine].begin(), vmsOnMachine[machine].end());
+            for (VMId_t vm : idle) RetireVM(vm);
+            DeactivateMachine(machine);
         }
+        SetMachineState(machine, next);
     }
     
-    // Monitor SLA0 tasks to prevent violations
-    MonitorSLA0Tasks(now);
-    
-    // VM consolidation (only after initial startup phase)
-    if (now > 1000000) {
-        std::vector<MachineId_t> underutilizedMachines;
-        for (MachineId_t machine : activeMachines) {
-            if (machineUtilization[machine] < UNDERLOAD_THRESHOLD) {
-                // Check if this machine has any SLA0 tasks
-                bool hasSLA0 = false;
-                for (VMId_t vm : vms) {
-                    if (IsVMMigrating(vm)) continue;
-                    
-                    VMInfo_t vmInfo = VM_GetInfo(vm);
-                    if (vmInfo.machine_id != machine) continue;
-                    
-                    for (TaskId_t task : vmInfo.active_tasks) {
-                        if (RequiredSLA(task) == SLA0) {
-                            hasSLA0 = true;
-                            break;
-                        }
-                    }
-                    
-                    if (hasSLA0) break;
-                }
-                
-                // Only consider consolidating machines without SLA0 tasks
-                if (!hasSLA0) {
-                    underutilizedMachines.push_back(machine);
-                }
+    // Keep some capacity of every CPU type awake, waking the shallowest sleeper first
+    for (auto &pair : machinePools) {
+        if (pair.second.active.size() >= MIN_WARM_MACHINES) continue;
+        MachineId_t machine = NextMachineToWake(pair.first);
+        if (machine == MachineId_t(-1)) continue;
+        SetMachineState(machine, S0);
+        ActivateMachine(machine);
+    }
+}
+
+void Scheduler::PlanConsolidation(Time_t now) {
+    // Only after the start-up burst has settled
+    if (now <= params.consolidationStart) return;
+    
+    // First-fit decreasing per CPU type: drain the emptiest machines (no SLA0 tasks, below
+    // the underload threshold) into the busiest ones that stay within the overload threshold and
+    // their memory. A machine is only drained if all of its VMs fit and can leave at once, and
+    // the sleep that buys it outweighs the moves; anything else is left to GovernPower.
+    for (auto &pair : machinePools) {
+        MachinePool_t &pool = pair.second;
+        std::vector<std::pair<double, MachineId_t>> sources;
+        for (const MachineTier_t &tier : pool.tiers) {
+            for (const std::pair<double, MachineId_t> &entry : tier.byUtilization) {
+                if (entry.first >= params.underloadThreshold) break;
+                sources.push_back(entry);
             }
         }
+        if (sources.empty()) continue;
+        std::sort(sources.begin(), sources.end());
         
-        if (!underutilizedMachines.empty()) {
-            MachineId_t sourceMachine = underutilizedMachines[0];
-            MachineInfo_t sourceInfo = Machine_GetInfo(sourceMachine);
+        // Draining and migrating leave the destinations' power state and SLA mix alone, so
+        // they are picked out once per pool rather than once per VM
+        std::vector<MachineId_t> targets;
+        for (MachineId_t target : pool.active) {
+            if (IsMachineAwake(target) && !MachineHasSLA(target, SLA0)) targets.push_back(target);
+        }
+        
+        // Tasks and memory this plan has already committed to each destination
+        std::map<MachineId_t, std::pair<unsigned, unsigned>> planned;
+        
+        for (const std::pair<double, MachineId_t> &candidate : sources) {
+            MachineId_t source = candidate.second;
+            if (migrationsInFlight >= MAX_CONCURRENT_MIGRATIONS) return;
+            if (!IsMachineAwake(source) || inboundMigrations[source] > 0 || planned.count(source)) continue;
+            if (MachineHasSLA(source, SLA0)) continue;
             
-            if (sourceInfo.active_vms > 0) {
-                VMId_t vmToMigrate = VMId_t(-1);
-                
-                // Find a VM without SLA0 tasks
-                for (VMId_t vm : vms) {
-                    if (IsVMMigrating(vm)) continue;
-                    
-                    VMInfo_t vmInfo = VM_GetInfo(vm);
-                    if (vmInfo.machine_id != sourceMachine) continue;
-                    
-                    bool hasSLA0 = false;
-                    for (TaskId_t task : vmInfo.active_tasks) {
-                        if (RequiredSLA(task) == SLA0) {
-                            hasSLA0 = true;
-                            break;
-                        }
-                    }
-                    
-                    if (!hasSLA0) {
-                        vmToMigrate = vm;
-                        break;
-                    }
-                }
-                
-                // If no VM without SLA0 tasks found, use any VM
-                if (vmToMigrate == VMId_t(-1)) {
-                    for (VMId_t vm : vms) {
-                        VMInfo_t vmInfo = VM_GetInfo(vm);
-                        if (vmInfo.machine_id == sourceMachine) {
-                            vmToMigrate = vm;
-                            break;
-                        }
-                    }
-                }
-                
-                if (vmToMigrate != VMId_t(-1) && !IsVMMigrating(vmToMigrate)) {
-                    VMInfo_t vmInfo = VM_GetInfo(vmToMigrate);
-                    CPUType_t vmCpuType = vmInfo.cpu;
-                    MachineId_t targetMachine = MachineId_t(-1);
-                    double bestUtilization = 0.0;
-                    
-                    for (MachineId_t machine : activeMachines) {
-                        if (machine == sourceMachine) continue;
-                        
-                        MachineInfo_t machineInfo = Machine_GetInfo(machine);
-                        if (machineInfo.cpu == vmCpuType && 
-                            machineUtilization[machine] > bestUtilization && 
-                            machineUtilization[machine] < OVERLOAD_THRESHOLD) {
-                            targetMachine = machine;
-                            bestUtilization = machineUtilization[machine];
-                        }
-                    }
-                    
-                    if (targetMachine != MachineId_t(-1)) {
-                        MarkVMAsMigrating(vmToMigrate);
-                        VM_Migrate(vmToMigrate, targetMachine);
+            // VMs stay within their GPU tier when it has room. Idle VMs are shut down rather
+            // than migrated; migration time does not depend on load. Machines with no work at
+            // all are left to GovernPower.
+            std::vector<VMId_t> moving, idle;
+            bool movable = true;
+            for (VMId_t vm : vmsOnMachine[source]) {
+                movable = movable && !IsVMMigrating(vm) && CanAffordMigration(vm, now);
+                (GetVMTaskCount(vm) > 0 ? moving : idle).push_back(vm);
+            }
+            if (!movable || moving.empty() || moving.size() > MAX_CONCURRENT_MIGRATIONS - migrationsInFlight) continue;
+            std::sort(moving.begin(), moving.end(), [this](VMId_t a, VMId_t b) {
+                return GetVMTaskCount(a) > GetVMTaskCount(b);
+            });
+            
+            std::map<MachineId_t, std::pair<unsigned, unsigned>> trial = planned;
+            std::vector<MachineId_t> destinations;
+            for (VMId_t vm : moving) {
+                unsigned tasks = GetVMTaskCount(vm);
+                unsigned memory = GetVMMemory(vm);
+                MachineId_t best = MachineId_t(-1);
+                std::pair<bool, double> bestFit(false, -1.0);
+                for (MachineId_t target : targets) {
+                    if (target == source || IsMachineDraining(target)) continue;
+                    auto promised = trial.find(target);
+                    std::pair<unsigned, unsigned> extra = promised == trial.end() ? std::make_pair(0u, 0u) : promised->second;
+                    unsigned cores = GetMachineCores(target);
+                    unsigned load = GetMachineTaskCount(target) + extra.first + tasks;
+                    if (load > params.overloadThreshold * cores) continue;
+                    if (GetMachineMemory(target) + extra.second + memory > GetMachineSpec(target).memory_size) continue;
+                    std::pair<bool, double> fit(MachineHasGPU(target) == MachineHasGPU(source),
+                                                cores > 0 ? double(load) / cores : 0.0);
+                    if (fit > bestFit) {
+                        bestFit = fit;
+                        best = target;
                     }
                 }
+                if (best == MachineId_t(-1)) break;
+                trial[best].first += tasks;
+                trial[best].second += memory;
+                destinations.push_back(best);
             }
+            if (destinations.size() < moving.size()) continue;
+            if (!DrainPaysOff(source, moving, destinations, now)) continue;
+            
+            planned.swap(trial);
+            for (VMId_t vm : idle) RetireVM(vm);
+            DrainMachine(source);
+            for (size_t i = 0; i < moving.size(); i++) MigrateVM(moving[i], destinations[i], now);
         }
     }
 }
 
+bool Scheduler::DrainPaysOff(MachineId_t source, const std::vector<VMId_t> &moving,
+                             const std::vector<MachineId_t> &destinations, Time_t now) const {
+    // The source sleeps in DRAINED_STATE from when its last VM lands until its work would
+    // have finished there; until then both ends of every migration stay in S0
+    const std::vector<unsigned> &s_states = GetMachineSpec(source).s_states;
+    if (s_states.size() <= DRAINED_STATE) return false;
+    Time_t busyUntil = now;
+    for (VMId_t vm : moving) {
+        for (TaskId_t task : vmTasks[vm]) busyUntil = std::max(busyUntil, ProjectCompletion(task, now));
+    }
+    Time_t landed = now;
+    double cost = 0.0;
+    for (size_t i = 0; i < moving.size(); i++) {
+        MigrationCost_t migration = EstimateMigration(moving[i], destinations[i]);
+        landed = std::max(landed, now + migration.duration);
+        cost += migration.energy;
+    }
+    if (busyUntil <= landed) return false;
+    double saved = double(s_states[S0] - s_states[DRAINED_STATE]) * double(busyUntil - landed) / 1000000.0;
+    return saved > cost;
+}
+
+bool Scheduler::CanAffordMigration(VMId_t vm, Time_t now) const {
+    // Every task with an SLA must still meet its target after stalling for a migration
+    for (TaskId_t task : vmTasks[vm]) {
+        if (GetTaskSLA(task) == SLA3) continue;
+        if (ProjectCompletion(task, now) + MigrationDuration(vmMemory[vm]) > GetTaskInfo(task).target_completion) return false;
+    }
+    return true;
+}
+
+Time_t Scheduler::MigrationDuration(unsigned memory) const {
+    // No spread in the observed sizes leaves nothing to fit a per-MB term to
+    const MigrationFit_t &fit = migrationFit;
+    double variance = fit.memorySquared - fit.memory * fit.memory;
+    double slope = variance > 1.0 ? std::max(0.0, (fit.product - fit.memory * fit.duration) / variance) : 0.0;
+    return Time_t(std::max(0.0, fit.duration + slope * (double(memory) - fit.memory)));
+}
+
+MigrationCost_t Scheduler::EstimateMigration(VMId_t vm, MachineId_t destination) const {
+    Time_t duration = MigrationDuration(vmMemory[vm]);
+    double power = 0.0;
+    for (MachineId_t machine : {vmHost[vm], destination}) {
+        const std::vector<unsigned> &s_states = GetMachineSpec(machine).s_states;
+        if (!s_states.empty()) power += s_states[S0];
+    }
+    return MigrationCost_t{duration, power * duration / 1000000.0};
+}
+
+bool Scheduler::MigrationPays(VMId_t vm, TaskId_t task, MachineId_t destination, Time_t now) const {
+    // After the stall the task runs at the destination's P0, shared with the tasks already there
+    const MachineSpec_t &spec = GetMachineSpec(destination);
+    if (spec.performance.empty()) return false;
+    unsigned tasks = GetMachineTaskCount(destination) + GetVMTaskCount(vm);
+    double mips = spec.performance[P0];
+    if (tasks > spec.num_cpus) mips = mips * spec.num_cpus / tasks;
+    Time_t moved = now + EstimateMigration(vm, destination).duration +
+                   Time_t(GetTaskInfo(task).remaining_instructions / mips);
+    return moved < ProjectCompletion(task, now);
+}
+
+void Scheduler::RelieveHotSpots(Time_t now) {
+    // Each VM is served once, in request order
+    std::set<VMId_t> served;
+    for (TaskId_t task : reliefRequests) {
+        VMId_t vm = GetTaskVM(task);
+        if (vm == VMId_t(-1) || IsVMMigrating(vm) || !served.insert(vm).second) continue;
+        if (migrationsInFlight >= MAX_CONCURRENT_MIGRATIONS) break;
+        
+        MachineId_t source = vmHost[vm];
+        unsigned load = GetMachineTaskCount(source);
+        if (load <= GetMachineCores(source)) continue;
+        
+        // Of the awake hosts with room for the VM and under half the load, those where the
+        // task would finish sooner; the move that costs the least energy, then the least
+        // loaded host
+        MachineId_t target = MachineId_t(-1);
+        std::pair<double, unsigned> targetKey;
+        for (MachineId_t machine : GetActiveMachines(GetVMCPU(vm))) {
+            if (machine == source || !IsMachineAwake(machine) || IsMachineDraining(machine) ||
+                !FitsMemory(machine, GetVMMemory(vm)) || GetMachineTaskCount(machine) >= load / 2) continue;
+            if (!MigrationPays(vm, task, machine, now)) continue;
+            std::pair<double, unsigned> key(EstimateMigration(vm, machine).energy, GetMachineTaskCount(machine));
+            if (target == MachineId_t(-1) || key < targetKey) {
+                target = machine;
+                targetKey = key;
+            }
+        }
+        if (target != MachineId_t(-1)) MigrateVM(vm, target, now);
+    }
+}
+
 void Scheduler::TaskComplete(Time_t now, TaskId_t task_id) {
-    // Update machine utilization
+    // Only the machine that hosted the task changes utilization
+    VMId_t vm = GetTaskVM(task_id);
+    if (vm == VMId_t(-1)) return;
+    LogEvent(EVENT_TASK_COMPLETED, task_id, vm);
+    machinePools[GetVMCPU(vm)].departures.count++;
+    ForgetTask(vm, task_id);
+}
+
+#ifdef SCHEDULER_DEBUG
+void Scheduler::VerifyUtilization(Time_t now) {
+    // Recompute every machine's utilization from the simulator and compare it with the
+    // incrementally maintained value. The scheduler keeps charging a migrating VM's tasks to
+    // the source until it lands, while the simulator only counts those MigrateVM saw left
+    // behind there, and only until its clock moves on; the others are left out of the comparison.
+    if (now != residueAt) migrationResidue.clear();
     for (MachineId_t machine : machines) {
+        COUNT_CALL(CALL_MACHINE_GET_INFO);
         MachineInfo_t info = Machine_GetInfo(machine);
-        double utilization = 0.0;
-        if (info.num_cpus > 0) 
+        unsigned tasks = GetMachineTaskCount(machine);
+        unsigned settled = tasks;
+        for (VMId_t vm : vmsOnMachine[machine]) {
+            if (!IsVMMigrating(vm)) continue;
+            auto residue = migrationResidue.find(vm);
+            settled -= GetVMTaskCount(vm) - (residue != migrationResidue.end() ? residue->second : 0);
+        }
+        double utilization = 0.0, counted = 0.0, expected = 0.0;
+        if (info.num_cpus > 0) {
             utilization = static_cast<double>(info.active_tasks) / info.num_cpus;
-        machineUtilization[machine] = utilization;
+            counted = static_cast<double>(tasks) / info.num_cpus;
+            expected = static_cast<double>(settled) / info.num_cpus;
+        }
+        if (counted != machineUtilization[machine] || expected != utilization) {
+            SCHED_LOG(0, "Scheduler::VerifyUtilization(): Utilization of machine " + to_string(machine) +
+                         " is " + to_string(machineUtilization[machine]) + " (" + to_string(expected) +
+                         " without migrating VMs) but should be " + to_string(counted) + " (" +
+                         to_string(utilization) + ") at time " + to_string(now));
+        }
+    }
+}
+#endif
+
+void Scheduler::MigrationComplete(Time_t time, VMId_t vm_id) {
+    // Move the VM to its new host in the machine index
+    MachineId_t source = vmHost[vm_id];
+    MachineId_t destination = vmDestination[vm_id];
+    vmsOnMachine[source].erase(vm_id);
+    vmsOnMachine[destination].insert(vm_id);
+    vmHost[vm_id] = destination;
+    machineMemory[source] -= vmMemory[vm_id];
+    
+    // Carry the VM's SLA counts over to its new host
+    const SLACount_t &vmCount = vmSLACount[vm_id];
+    for (unsigned sla = 0; sla < NUM_SLAS; sla++) {
+        machineSLACount[source][sla] -= vmCount[sla];
+        machineSLACount[destination][sla] += vmCount[sla];
+    }
+    UpdateUtilization(source);
+    UpdateUtilization(destination);
+    MarkVMAsReady(vm_id);
+#ifdef SCHEDULER_DEBUG
+    migrationResidue.erase(vm_id);
+#endif
+    LogEvent(EVENT_MIGRATION_DONE, vm_id, source, destination);
+    double memory = vmMemory[vm_id];
+    double duration = double(time - vmMigratedAt[vm_id]);
+    migrationFit.memory += MIGRATION_LATENCY_WEIGHT * (memory - migrationFit.memory);
+    migrationFit.duration += MIGRATION_LATENCY_WEIGHT * (duration - migrationFit.duration);
+    migrationFit.memorySquared += MIGRATION_LATENCY_WEIGHT * (memory * memory - migrationFit.memorySquared);
+    migrationFit.product += MIGRATION_LATENCY_WEIGHT * (memory * duration - migrationFit.product);
+    inboundMigrations[destination]--;
+    migrationsInFlight--;
+    
+    // The last VM has left a machine being consolidated away
+    if (IsMachineDraining(source) && vmsOnMachine[source].empty()) SleepMachine(source);
+    
+    AdmitPending(GetVMCPU(vm_id));
+}
+
+// Parses one fork variant over a copy of the current tunables
+static bool ParseVariant(const string &text, SchedulerParams_t &params) {
+    std::istringstream in(text);
+    string field;
+    for (unsigned i = 0; i < 3; i++) {
+        if (!std::getline(in, field, ':')) return i > 0;
+        if (field.empty()) continue;
+        std::istringstream value(field);
+        bool parsed = i == 0 ? bool(value >> params.underloadThreshold)
+                    : i == 1 ? bool(value >> params.overloadThreshold)
+                             : bool(value >> params.consolidationStart);
+        if (!parsed || !value.eof()) return false;
+    }
+    return in.peek() == EOF;
+}
+
+void Scheduler::ForkVariants(Time_t now) {
+    // fork() is the snapshot: each child starts from this exact simulator and scheduler
+    // state, shared copy-on-write with the parent. Buffered output is flushed first so it
+    // is not written twice. The event log's writer thread would not survive the fork, so
+    // the log is closed across it and every process reopens its own.
+    forkAt = NO_FORK;
+    cout.flush();
+    if (sampleInterval > 0) samples.flush();
+    bool logging = events.IsOpen();
+    events.Close();
+    
+    std::istringstream in(forkVariants);
+    string text;
+    for (unsigned i = 0; std::getline(in, text, ','); i++) {
+        SchedulerParams_t variant = params;
+        if (!ParseVariant(text, variant)) {
+            SCHED_LOG(0, "Scheduler::ForkVariants(): ignoring variant " + text);
+            continue;
+        }
+        pid_t child = fork();
+        if (child < 0) {
+            SCHED_LOG(0, "Scheduler::ForkVariants(): fork failed at variant " + text);
+            break;
+        }
+        if (child > 0) {
+            forkedVariants.push_back(child);
+            continue;
+        }
+        
+        // The child: its own tunables and output, and no variants of its own
+        params = variant;
+        forkedVariants.clear();
+        string output = forkOutput + "." + to_string(i);
+        int fd = open(output.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd >= 0) {
+            dup2(fd, STDOUT_FILENO);
+            close(fd);
+        }
+        if (sampleInterval > 0) {
+            samples.close();
+            samples.open(sampleFile + "." + to_string(i));
+            samples << "time_us,machine,s_state,p_state,tasks,utilization,energy\n";
+        }
+        if (logging && events.Open(eventFile + "." + to_string(i), false))
+            LogEvent(EVENT_LOG_START, EVENT_LOG_VERSION, sizeof(EventRecord_t));
+        cout << "Forked at " << now << " us: underload " << params.underloadThreshold << ", overload "
+             << params.overloadThreshold << ", consolidation from " << params.consolidationStart << endl;
+        return;
     }
+    if (logging) events.Open(eventFile, true);
+}
+
+void Scheduler::WaitForVariants() {
+    for (int child : forkedVariants) waitpid(child, nullptr, 0);
+    forkedVariants.clear();
 }
 
 void Scheduler::Shutdown(Time_t time) {
+    // The last row holds the final totals
+    if (sampleInterval > 0) {
+        SampleEnergy(time);
+        samples.close();
+    }
+    events.Close();
     for(auto & vm: vms) {
         VM_Shutdown(vm);
     }
+    for (std::set<VMId_t> &hosted : vmsOnMachine) hosted.clear();
+    std::fill(vmHost.begin(), vmHost.end(), MachineId_t(-1));
 }
 
-void Scheduler::MonitorSLA0Tasks(Time_t now) {
-    // Find all SLA0 tasks
-    std::vector<std::pair<TaskId_t, VMId_t>> sla0Tasks;
+Time_t Scheduler::ProjectCompletion(TaskId_t task, Time_t now) const {
+    // Remaining instructions at the host's current MIPS rating, shared with the other
+    // tasks on the machine once there are more tasks than cores
+    MachineId_t machine = GetVMMachine(GetTaskVM(task));
+    const MachineSpec_t &spec = GetMachineSpec(machine);
+    CPUPerformance_t p_state = machinePState[machine] == P_UNKNOWN ? P0 : machinePState[machine];
+    double mips = spec.performance[p_state];
+    unsigned tasks = GetMachineTaskCount(machine);
+    if (tasks > spec.num_cpus) mips = mips * spec.num_cpus / tasks;
     
-    for (VMId_t vm : vms) {
-        if (IsVMMigrating(vm)) continue;
-        
-        VMInfo_t vmInfo = VM_GetInfo(vm);
-        for (TaskId_t task : vmInfo.active_tasks) {
-            if (RequiredSLA(task) == SLA0) {
-                sla0Tasks.push_back(std::make_pair(task, vm));
-            }
+    return now + Time_t(GetTaskInfo(task).remaining_instructions / mips);
+}
+
+CPUPerformance_t Scheduler::PlanPerformance(MachineId_t machine, Time_t now) const {
+    unsigned tasks = GetMachineTaskCount(machine);
+    if (tasks == 0) return P3;
+    const MachineSpec_t &spec = GetMachineSpec(machine);
+    unsigned states = std::min(spec.performance.size(), spec.p_states.size());
+    if (states == 0) return P0;
+    
+    // Energy per instruction at each P-state: the machine's S0 power plus its busy cores,
+    // for as long as the work takes. The machine's static power usually makes racing to
+    // idle at P0 the cheapest, in which case no task needs looking at.
+    double busy = std::min(tasks, spec.num_cpus);
+    double base = spec.s_states.empty() ? 0.0 : double(spec.s_states[S0]);
+    auto energy = [&](unsigned p) { return (base + busy * spec.p_states[p]) / spec.performance[p]; };
+    unsigned cheapest = 0;
+    for (unsigned p = 1; p < states; p++) {
+        if (energy(p) < energy(cheapest)) cheapest = p;
+    }
+    if (cheapest == 0) return P0;
+    
+    // Every task with an SLA must finish outside its risk margin at the chosen P-state, so
+    // MonitorSLATasks has no reason to undo the choice. Feasibility only shrinks with speed.
+    double share = tasks > spec.num_cpus ? double(spec.num_cpus) / tasks : 1.0;
+    unsigned slowest = cheapest;
+    for (VMId_t vm : vmsOnMachine[machine]) {
+        for (TaskId_t task : vmTasks[vm]) {
+            if (GetTaskSLA(task) == SLA3) continue;
+            TaskInfo_t info = GetTaskInfo(task);
+            double margin = SLA_RISK_SLACK * (info.target_completion - info.arrival);
+            double budget = double(info.target_completion) - margin - double(now);
+            while (slowest > 0 && info.remaining_instructions / (spec.performance[slowest] * share) > budget)
+                slowest--;
+            if (slowest == 0) return P0;
         }
     }
     
-    // For each SLA0 task, check if it's at risk
-    for (const auto& pair : sla0Tasks) {
-        TaskId_t task = pair.first;
-        VMId_t vm = pair.second;
+    // The cheapest of the P-states fast enough; the faster one on a tie, so the machine
+    // idles sooner
+    unsigned best = 0;
+    for (unsigned p = 1; p <= slowest; p++) {
+        if (energy(p) < energy(best)) best = p;
+    }
+    return CPUPerformance_t(best);
+}
+
+void Scheduler::TrackSLARisk(TaskId_t task, Time_t at) {
+    auto it = liveTasks.find(task);
+    if (it == liveTasks.end() || it->second.sla == SLA3) return;
+    it->second.riskCheckAt = at;
+    riskQueue.Push(at, task);
+}
+
+void CalendarQueue::PopDue(Time_t now, std::vector<std::pair<Time_t, TaskId_t>> &due) {
+    due.clear();
+    if (now < cursor) return;
+    if (count == 0) {
+        cursor = now + 1;
+        return;
+    }
+    // One pass over a bucket per BUCKET_WIDTH elapsed, at most one over the whole calendar
+    Time_t first = cursor / BUCKET_WIDTH, last = now / BUCKET_WIDTH;
+    if (last - first >= BUCKETS) last = first + BUCKETS - 1;
+    for (Time_t slot = first; slot <= last; slot++) {
+        std::vector<std::pair<Time_t, TaskId_t>> &bucket = buckets[slot % BUCKETS];
+        auto later = std::partition(bucket.begin(), bucket.end(),
+                                    [now](const std::pair<Time_t, TaskId_t> &entry) { return entry.first > now; });
+        due.insert(due.end(), later, bucket.end());
+        bucket.erase(later, bucket.end());
+    }
+    count -= due.size();
+    cursor = now + 1;
+    std::sort(due.begin(), due.end());
+}
+
+void Scheduler::MonitorSLATasks(Time_t now) {
+    // Only the tasks whose next check has come due are looked at; stale queue entries
+    // (task finished, moved or rescheduled since) are dropped as they surface
+    riskQueue.PopDue(now, riskDue);
+    for (const std::pair<Time_t, TaskId_t> &entry : riskDue) {
+        TaskId_t task = entry.second;
+        auto it = liveTasks.find(task);
+        if (it == liveTasks.end() || it->second.riskCheckAt != entry.first) continue;
+        TaskState_t &state = it->second;
         
-        VMInfo_t vmInfo = VM_GetInfo(vm);
-        MachineId_t machine = vmInfo.machine_id;
-        MachineInfo_t machineInfo = Machine_GetInfo(machine);
+        VMId_t vm = state.vm;
+        if (IsVMMigrating(vm)) {
+            TrackSLARisk(task, now + 1);
+            continue;
+        }
         
-        // If the machine has more than 2 tasks per CPU, consider the SLA0 task at risk
-        if (machineInfo.active_tasks > machineInfo.num_cpus * 2) {
-            // Ensure this task has HIGH_PRIORITY
-            SetTaskPriority(task, HIGH_PRIORITY);
-            
-            // Set machine to maximum performance
-            for (unsigned i = 0; i < machineInfo.num_cpus; i++) {
-                Machine_SetCorePerformance(machine, i, P0);
-            }
-            
-            // If there are multiple tasks on this VM, try to move non-SLA0 tasks
-            if (vmInfo.active_tasks.size() > 1) {
-                for (TaskId_t otherTask : vmInfo.active_tasks) {
-                    if (otherTask != task && RequiredSLA(otherTask) != SLA0) {
-                        // Find another VM for this task
-                        VMId_t targetVM = VMId_t(-1);
-                        for (VMId_t otherVM : vms) {
-                            if (otherVM == vm || IsVMMigrating(otherVM)) continue;
-                            
-                            VMInfo_t otherVMInfo = VM_GetInfo(otherVM);
-                            if (otherVMInfo.cpu == vmInfo.cpu) {
-                                targetVM = otherVM;
-                                break;
-                            }
-                        }
-                        
-                        if (targetVM != VMId_t(-1)) {
-                            // Move the non-SLA0 task to another VM
-                            Priority_t priority;
-                            SLAType_t otherSlaType = RequiredSLA(otherTask);
-                            switch (otherSlaType) {
-                                case SLA1: priority = MID_PRIORITY; break;
-                                case SLA2: priority = LOW_PRIORITY; break;
-                                default: priority = LOW_PRIORITY; break;
-                            }
-                            
-                            if (SafeRemoveTask(vm, otherTask)) {
-                                VM_AddTask(targetVM, otherTask, priority);
-                                break; // Just move one task for now
-                            }
-                        }
-                    }
+        TaskInfo_t info = GetTaskInfo(task);
+        Time_t projected = ProjectCompletion(task, now);
+        double margin = SLA_RISK_SLACK * (info.target_completion - info.arrival);
+        double slack = double(info.target_completion) - double(projected);
+        
+        if (slack > margin) {
+            // Slack shrinks by at most the elapsed time while the task makes no progress,
+            // so nothing can change before it has eaten into the margin
+            Time_t wait = std::min(Time_t(slack - margin), RISK_RECHECK_LIMIT);
+            TrackSLARisk(task, now + std::max(wait, Time_t(1)));
+            continue;
+        }
+        
+        // At risk: hand the task to the SLA reaction, then wait for the host to change.
+        // The host is held at P0 every time; the reaction only runs once per task.
+        MachineId_t machine = GetVMMachine(vm);
+        state.riskCheckAt = RISK_UNTRACKED;
+        riskParked[machine].push_back(task);
+        if (state.sla != SLA2) SetMachinePerformance(machine, P0);
+        if (state.escalated) continue;
+        state.escalated = true;
+        ActivePolicy::SLAReaction::OnRisk(*this, now, task);
+    }
+}
+
+// Policy plug-ins, see Scheduler.hpp
+
+VMId_t HeadroomPlacement::PickVM(const Scheduler &scheduler, CPUType_t cpu, VMType_t vm_type, SLAType_t sla,
+                                 bool gpu, bool withinCapacity, unsigned memory) {
+    const MachineTier_t *tier = scheduler.GetTier(cpu, gpu);
+    if (tier == nullptr) return VMId_t(-1);
+    
+    // Host memory is only overcommitted for tasks no host could hold, which PlaceTask asks
+    // to place with no memory. SLA0 tasks take a VM with only SLA0 tasks (or none)
+    // on the host with the most headroom; the others pack onto the busiest hosts with room,
+    // the one with the least headroom among them, or spread once everything is full.
+    auto ready = [&](VMId_t vm, MachineId_t host) {
+        return scheduler.GetVMType(vm) == vm_type && scheduler.IsVMReady(vm) && scheduler.FitsMemory(host, memory) &&
+               (!withinCapacity || scheduler.HasRoom(host));
+    };
+    
+    VMId_t best = VMId_t(-1);
+    if (sla != SLA0 && withinCapacity) {
+        // Down from the first utilization without room, stopping after the busiest level with a fit
+        std::pair<double, VMId_t> bestKey;
+        double level = 0.0;
+        auto it = tier->byUtilization.lower_bound(std::make_pair(scheduler.FullUtilization(), MachineId_t(0)));
+        while (it != tier->byUtilization.begin()) {
+            --it;
+            if (best != VMId_t(-1) && it->first != level) break;
+            MachineId_t host = it->second;
+            for (VMId_t vm : scheduler.GetVMsOnMachine(host)) {
+                if (!ready(vm, host)) continue;
+                std::pair<double, VMId_t> key(scheduler.Headroom(host, memory), vm);
+                if (best == VMId_t(-1) || key < bestKey) {
+                    best = vm;
+                    bestKey = key;
+                    level = it->first;
                 }
             }
         }
+        return best;
+    }
+    
+    // Headroom only shrinks as utilization grows, so the walk ends once no host left can
+    // beat the best VM found; for SLA0, once that VM runs only SLA0 tasks
+    std::pair<bool, double> bestKey;
+    for (const std::pair<double, MachineId_t> &entry : tier->byUtilization) {
+        if (best != VMId_t(-1) && !bestKey.first && scheduler.MaxHeadroom(entry.first) <= -bestKey.second) break;
+        MachineId_t host = entry.second;
+        for (VMId_t vm : scheduler.GetVMsOnMachine(host)) {
+            if (!ready(vm, host)) continue;
+            bool mixed = sla == SLA0 && scheduler.GetVMTaskCount(vm) != scheduler.GetVMSLACount(vm, SLA0);
+            std::pair<bool, double> key(mixed, -scheduler.Headroom(host, memory));
+            if (best == VMId_t(-1) || key < bestKey) {
+                best = vm;
+                bestKey = key;
+            }
+        }
     }
+    return best;
 }
 
-void InitScheduler() {
-    scheduler.Init();
+MachineId_t HeadroomPlacement::PickHost(const Scheduler &scheduler, CPUType_t cpu, SLAType_t sla,
+                                        bool gpu, bool withinCapacity, unsigned memory) {
+    const MachineTier_t *tier = scheduler.GetTier(cpu, gpu);
+    if (tier == nullptr) return MachineId_t(-1);
+    
+    // A new VM also reserves VM_MEMORY_OVERHEAD. SLA0 tasks, and every task once nothing has
+    // room, get the host with the most headroom; the others the one with the least among
+    // the busiest hosts with room. Both walks stop as soon as no host left can do better.
+    memory += VM_MEMORY_OVERHEAD;
+    auto fits = [&](MachineId_t machine) {
+        return scheduler.IsMachineAwake(machine) && scheduler.CanHostVM(machine) && scheduler.FitsMemory(machine, memory) &&
+               (!withinCapacity || scheduler.HasRoom(machine));
+    };
+    
+    MachineId_t best = MachineId_t(-1);
+    double bestHeadroom = 0.0;
+    if (sla != SLA0 && withinCapacity) {
+        double level = 0.0;
+        auto it = tier->byUtilization.lower_bound(std::make_pair(scheduler.FullUtilization(), MachineId_t(0)));
+        while (it != tier->byUtilization.begin()) {
+            --it;
+            if (best != MachineId_t(-1) && it->first != level) break;
+            if (!fits(it->second)) continue;
+            double headroom = scheduler.Headroom(it->second, memory);
+            if (best == MachineId_t(-1) || headroom < bestHeadroom) {
+                best = it->second;
+                bestHeadroom = headroom;
+                level = it->first;
+            }
+        }
+        return best;
+    }
+    
+    for (const std::pair<double, MachineId_t> &entry : tier->byUtilization) {
+        if (best != MachineId_t(-1) && scheduler.MaxHeadroom(entry.first) <= bestHeadroom) break;
+        MachineId_t machine = entry.second;
+        if (!fits(machine)) continue;
+        double headroom = scheduler.Headroom(machine, memory);
+        if (best == MachineId_t(-1) || headroom > bestHeadroom) {
+            best = machine;
+            bestHeadroom = headroom;
+        }
+    }
+    return best;
 }
 
-void HandleNewTask(Time_t time, TaskId_t task_id) {
-    scheduler.NewTask(time, task_id);
+VMId_t FirstFitPlacement::PickVM(const Scheduler &scheduler, CPUType_t cpu, VMType_t vm_type, SLAType_t sla,
+                                 bool gpu, bool withinCapacity, unsigned memory) {
+    const std::set<VMId_t> *pool = scheduler.GetVMPool(cpu, vm_type);
+    if (pool == nullptr) return VMId_t(-1);
+    for (VMId_t vm : *pool) {
+        MachineId_t host = scheduler.GetVMMachine(vm);
+        if (!scheduler.IsVMReady(vm) || scheduler.MachineHasGPU(host) != gpu || !scheduler.FitsMemory(host, memory)) continue;
+        if (!withinCapacity || scheduler.HasRoom(host)) return vm;
+    }
+    return VMId_t(-1);
 }
 
-void HandleTaskCompletion(Time_t time, TaskId_t task_id) {
-    scheduler.TaskComplete(time, task_id);
+MachineId_t FirstFitPlacement::PickHost(const Scheduler &scheduler, CPUType_t cpu, SLAType_t sla,
+                                        bool gpu, bool withinCapacity, unsigned memory) {
+    const MachineTier_t *tier = scheduler.GetTier(cpu, gpu);
+    if (tier == nullptr) return MachineId_t(-1);
+    for (MachineId_t machine : tier->active) {
+        if (!scheduler.IsMachineAwake(machine) || !scheduler.CanHostVM(machine)) continue;
+        if (!scheduler.FitsMemory(machine, memory + VM_MEMORY_OVERHEAD)) continue;
+        if (!withinCapacity || scheduler.HasRoom(machine)) return machine;
+    }
+    return MachineId_t(-1);
 }
 
-void MemoryWarning(Time_t time, MachineId_t machine_id) {
-    MachineInfo_t machineInfo = Machine_GetInfo(machine_id);
-    std::vector<VMId_t> vmsOnMachine;
+void ConsolidatingMigration::OnMemoryWarning(Scheduler &scheduler, Time_t time, MachineId_t machine_id) {
     std::map<VMId_t, unsigned> vmTaskCount;
     
-    // Find VMs on this machine and count their tasks
-    for (VMId_t vm : scheduler.GetVMs()) {
+    // Count the tasks of the VMs on this machine
+    for (VMId_t vm : scheduler.GetVMsOnMachine(machine_id)) {
         if (scheduler.IsVMMigrating(vm)) continue;
-        
-        VMInfo_t vmInfo;
-        try {
-            vmInfo = VM_GetInfo(vm);
-        } catch (...) {
-            continue;
-        }
-        
-        if (vmInfo.machine_id == machine_id) {
-            vmsOnMachine.push_back(vm);
-            vmTaskCount[vm] = vmInfo.active_tasks.size();
-        }
+        vmTaskCount[vm] = scheduler.GetVMTaskCount(vm);
     }
     
     // Find VM with most tasks, prioritizing those without SLA0 tasks
@@ -521,17 +1509,7 @@ void MemoryWarning(Time_t time, MachineId_t machine_id) {
         
         if (taskCount <= mostTasks) continue;
         
-        VMInfo_t vmInfo = VM_GetInfo(vm);
-        bool hasSLA0 = false;
-        
-        for (TaskId_t task : vmInfo.active_tasks) {
-            if (RequiredSLA(task) == SLA0) {
-                hasSLA0 = true;
-                break;
-            }
-        }
-        
-        if (!hasSLA0) {
+        if (!scheduler.VMHasSLA(vm, SLA0)) {
             mostTasks = taskCount;
             largestVM = vm;
         }
@@ -549,34 +1527,15 @@ void MemoryWarning(Time_t time, MachineId_t machine_id) {
     
     // Migrate the selected VM
     if (largestVM != VMId_t(-1) && !scheduler.IsVMMigrating(largestVM)) {
-        VMInfo_t vmInfo = VM_GetInfo(largestVM);
-        CPUType_t vmCpuType = vmInfo.cpu;
+        CPUType_t vmCpuType = scheduler.GetVMCPU(largestVM);
         MachineId_t targetMachine = MachineId_t(-1);
         
         // Find a suitable target machine
-        for (MachineId_t machine : scheduler.GetMachines()) {
-            if (machine == machine_id) continue;
-            if (!scheduler.IsMachineActive(machine)) continue;
+        for (MachineId_t machine : scheduler.GetActiveMachines(vmCpuType)) {
+            if (machine == machine_id || !scheduler.IsMachineAwake(machine) ||
+                !scheduler.FitsMemory(machine, scheduler.GetVMMemory(largestVM))) continue;
             
-            MachineInfo_t info = Machine_GetInfo(machine);
-            if (info.cpu != vmCpuType) continue;
-            
-            if (info.active_tasks < 2) { // Machine has 0 or 1 active tasks
-                targetMachine = machine;
-                break;
-            }
-        }
-        
-        // If no suitable active machine, power on a new one
-        if (targetMachine == MachineId_t(-1)) {
-            for (MachineId_t machine : scheduler.GetMachines()) {
-                if (scheduler.IsMachineActive(machine)) continue;
-                
-                MachineInfo_t info = Machine_GetInfo(machine);
-                if (info.cpu != vmCpuType) continue;
-                
-                Machine_SetState(machine, S0);
-                scheduler.ActivateMachine(machine);
+            if (scheduler.GetMachineTaskCount(machine) < 2) { // Machine has 0 or 1 active tasks
                 targetMachine = machine;
                 break;
             }
@@ -584,32 +1543,130 @@ void MemoryWarning(Time_t time, MachineId_t machine_id) {
         
         // Perform migration
         if (targetMachine != MachineId_t(-1)) {
-            scheduler.MarkVMAsMigrating(largestVM);
-            VM_Migrate(largestVM, targetMachine);
+            scheduler.MigrateVM(largestVM, targetMachine, time);
         } else {
-            // If no suitable target found, power on any machine
-            for (MachineId_t machine : scheduler.GetMachines()) {
-                if (scheduler.IsMachineActive(machine)) continue;
-                
-                Machine_SetState(machine, S0);
+            // If no suitable machine is up, power on a new one, of the VM's CPU type if
+            // possible. A migration can outrun a wake-up, so the VM stays until it is awake.
+            MachineId_t machine = scheduler.NextMachineToWake(vmCpuType);
+            if (machine == MachineId_t(-1)) machine = scheduler.NextMachineToWake();
+            if (machine != MachineId_t(-1)) {
+                scheduler.SetMachineState(machine, S0);
                 scheduler.ActivateMachine(machine);
-                break;
             }
         }
     }
+}
+
+// Hands the task's VM to the next tick's hot-spot relief. With no less loaded machine awake
+// to take it, one is powered on; a migration can outrun the wake-up, so the VM only moves
+// once a machine is awake.
+static void RelieveOrWake(Scheduler &scheduler, TaskId_t task, CPUType_t cpu, MachineId_t host) {
+    scheduler.RequestRelief(task);
+    unsigned load = scheduler.GetMachineTaskCount(host);
+    for (MachineId_t machine : scheduler.GetActiveMachines(cpu)) {
+        if (machine != host && scheduler.IsMachineAwake(machine) && scheduler.GetMachineTaskCount(machine) < load / 2) return;
+    }
+    MachineId_t machine = scheduler.NextMachineToWake(cpu);
+    if (machine != MachineId_t(-1)) {
+        scheduler.SetMachineState(machine, S0);
+        scheduler.ActivateMachine(machine);
+    }
+}
+
+void EscalatingSLAReaction::OnWarning(Scheduler &scheduler, Time_t time, TaskId_t task_id) {
+    SLAType_t slaType = scheduler.GetTaskSLA(task_id);
+    VMId_t taskVM = scheduler.GetTaskVM(task_id);
+    MachineId_t taskMachine = scheduler.GetVMMachine(taskVM);
     
-    // Set all cores to maximum performance to help process tasks faster
-    for (unsigned i = 0; i < machineInfo.num_cpus; i++) {
-        Machine_SetCorePerformance(machine_id, i, P0);
+    if (slaType == SLA0) {
+        // For SLA0, take immediate and aggressive action
+        scheduler.SetPriority(task_id, HIGH_PRIORITY);
+        
+        // Set machine to maximum performance
+        unsigned cores = scheduler.GetMachineCores(taskMachine);
+        unsigned machineTasks = scheduler.GetMachineTaskCount(taskMachine);
+        scheduler.SetMachinePerformance(taskMachine, P0);
+        
+        // If the machine is overloaded, try to reduce load
+        if (machineTasks > cores) {
+            CPUType_t vmCpuType = scheduler.GetVMCPU(taskVM);
+            
+            // First give the task the CPU share of the others on its VM, then try to move
+            // the VM off the overloaded machine; yielding leaves the task count as it was
+            scheduler.YieldToTask(taskVM, task_id);
+            RelieveOrWake(scheduler, task_id, vmCpuType, taskMachine);
+        }
+    }
+    else if (slaType == SLA1) {
+        // For SLA1, take action but less aggressive than SLA0
+        scheduler.SetPriority(task_id, HIGH_PRIORITY);
+        
+        unsigned cores = scheduler.GetMachineCores(taskMachine);
+        unsigned machineTasks = scheduler.GetMachineTaskCount(taskMachine);
+        scheduler.SetMachinePerformance(taskMachine, P0);
+        
+        // Only migrate if severely overloaded
+        if (machineTasks > cores * 2) RelieveOrWake(scheduler, task_id, scheduler.GetVMCPU(taskVM), taskMachine);
     }
+    else if (slaType == SLA2) {
+        // For SLA2, just increase priority
+        scheduler.SetPriority(task_id, HIGH_PRIORITY);
+    }
+}
+
+void EscalatingSLAReaction::OnRisk(Scheduler &scheduler, Time_t now, TaskId_t task) {
+    scheduler.SetPriority(task, HIGH_PRIORITY);
+    if (scheduler.GetTaskSLA(task) != SLA0) return;
+    
+    // SLA0: take CPU share from the other tasks on the VM, and move the VM off an
+    // overloaded host where that still pays
+    VMId_t vm = scheduler.GetTaskVM(task);
+    MachineId_t machine = scheduler.GetVMMachine(vm);
+    scheduler.YieldToTask(vm, task);
+    if (scheduler.GetMachineTaskCount(machine) > scheduler.GetMachineCores(machine)) scheduler.RequestRelief(task);
+}
+
+void PriorityOnlySLAReaction::OnWarning(Scheduler &scheduler, Time_t time, TaskId_t task_id) {
+    scheduler.SetPriority(task_id, HIGH_PRIORITY);
+    if (scheduler.GetTaskSLA(task_id) != SLA2) scheduler.SetMachinePerformance(scheduler.GetVMMachine(scheduler.GetTaskVM(task_id)), P0);
+}
+
+void InitScheduler() {
+    TIME_CALLBACK(CALLBACK_INIT);
+    scheduler.Init();
+}
+
+void HandleNewTask(Time_t time, TaskId_t task_id) {
+    TIME_CALLBACK(CALLBACK_NEW_TASK);
+    scheduler.NewTask(time, task_id);
+    scheduler.FlushPerformance();
+}
+
+void HandleTaskCompletion(Time_t time, TaskId_t task_id) {
+    TIME_CALLBACK(CALLBACK_TASK_COMPLETION);
+    scheduler.TaskComplete(time, task_id);
+}
+
+void MemoryWarning(Time_t time, MachineId_t machine_id) {
+    TIME_CALLBACK(CALLBACK_MEMORY_WARNING);
+    scheduler.LogEvent(EVENT_MEMORY_WARNING, machine_id);
+    ActivePolicy::Migration::OnMemoryWarning(scheduler, time, machine_id);
+    
+    // Set all cores to maximum performance to help process tasks faster
+    scheduler.SetMachinePerformance(machine_id, P0);
+    scheduler.FlushPerformance();
 }
 
 void MigrationDone(Time_t time, VMId_t vm_id) {
-    scheduler.MarkVMAsReady(vm_id);
+    TIME_CALLBACK(CALLBACK_MIGRATION_DONE);
+    scheduler.MigrationComplete(time, vm_id);
+    scheduler.FlushPerformance();
 }
 
 void SchedulerCheck(Time_t time) {
+    TIME_CALLBACK(CALLBACK_SCHEDULER_CHECK);
     scheduler.PeriodicCheck(time);
+    scheduler.FlushPerformance();
 }
 
 void SimulationComplete(Time_t time) {
@@ -619,210 +1676,63 @@ void SimulationComplete(Time_t time) {
     cout << "SLA2: " << GetSLAReport(SLA2) << "%" << endl;
     cout << "Total Energy " << Machine_GetClusterEnergy() << "KW-Hour" << endl;
     cout << "Simulation run finished in " << double(time)/1000000 << " seconds" << endl;
+#ifdef SCHEDULER_BENCH
+    cout << "Scheduler time " << std::chrono::duration<double>(callbackWallTime).count() << " seconds wall, "
+         << double(callbackCPUTime) / CLOCKS_PER_SEC << " seconds CPU" << endl;
+#endif
+#ifdef SCHEDULER_PROFILE
+    ReportProfile();
+#endif
     scheduler.Shutdown(time);
+    scheduler.WaitForVariants();
 }
 
 void StateChangeComplete(Time_t time, MachineId_t machine_id) {
-    MachineInfo_t machineInfo = Machine_GetInfo(machine_id);
-    MachineState_t currentState = machineInfo.s_state;
+    TIME_CALLBACK(CALLBACK_STATE_CHANGE);
+    COUNT_CALL(CALL_MACHINE_GET_INFO);
+    MachineState_t currentState = Machine_GetInfo(machine_id).s_state;
+    scheduler.ConfirmMachineState(machine_id, currentState, time);
     
-    if (currentState == S0) {
+    // Completions of requests that were superseded by a later one are ignored
+    if (currentState == S0 && scheduler.IsMachineAwake(machine_id)) {
         scheduler.ActivateMachine(machine_id);
         
         // Set initial performance state
-        for (unsigned i = 0; i < machineInfo.num_cpus; i++) {
-            Machine_SetCorePerformance(machine_id, i, P0);  // Start with high performance
-        }
+        scheduler.SetMachinePerformance(machine_id, P0);  // Start with high performance
         
         // Create a VM if none exists
         bool hasVM = false;
-        for (VMId_t vm : scheduler.GetVMs()) {
-            if (scheduler.IsVMMigrating(vm)) continue;
-            
-            VMInfo_t vmInfo = VM_GetInfo(vm);
-            if (vmInfo.machine_id == machine_id) {
+        for (VMId_t vm : scheduler.GetVMsOnMachine(machine_id)) {
+            if (!scheduler.IsVMMigrating(vm)) {
                 hasVM = true;
                 break;
             }
         }
         
         if (!hasVM) {
-            VMId_t newVM = VM_Create(LINUX, machineInfo.cpu);
-            VM_Attach(newVM, machine_id);
-            scheduler.AddVM(newVM);
+            scheduler.CreateVM(LINUX, scheduler.GetMachineCPU(machine_id), machine_id);
         }
+        scheduler.AdmitPending(scheduler.GetMachineCPU(machine_id));
     }
-    else if (currentState == S5) {
+    else if (currentState == S5 && scheduler.IsMachineSettled(machine_id)) {
         scheduler.DeactivateMachine(machine_id);
     }
     
     scheduler.PeriodicCheck(time);
+    scheduler.FlushPerformance();
 }
 
 void SLAWarning(Time_t time, TaskId_t task_id) {
-    SLAType_t slaType = RequiredSLA(task_id);
-    VMId_t taskVM = VMId_t(-1);
-    MachineId_t taskMachine = MachineId_t(-1);
+    TIME_CALLBACK(CALLBACK_SLA_WARNING);
+    scheduler.LogEvent(EVENT_SLA_WARNING, task_id, scheduler.GetTaskVM(task_id));
+    // The simulator reports late tasks as they finish, before HandleTaskCompletion;
+    // by then the task has already left its VM
+    if (IsTaskCompleted(task_id)) return;
     
-    // Find which VM is running this task
-    for (VMId_t vm : scheduler.GetVMs()) {
-        if (scheduler.IsVMMigrating(vm)) continue;
-        
-        VMInfo_t vmInfo = VM_GetInfo(vm);
-        for (TaskId_t task : vmInfo.active_tasks) {
-            if (task == task_id) {
-                taskVM = vm;
-                taskMachine = vmInfo.machine_id;
-                break;
-            }
-        }
-        
-        if (taskVM != VMId_t(-1)) break;
-    }
+    // Leave tasks whose VM is in flight alone until the migration completes
+    VMId_t taskVM = scheduler.GetTaskVM(task_id);
+    if (!scheduler.IsVMAlive(taskVM) || scheduler.IsVMMigrating(taskVM)) return;
     
-    if (taskVM != VMId_t(-1)) {
-        if (slaType == SLA0) {
-            // For SLA0, take immediate and aggressive action
-            SetTaskPriority(task_id, HIGH_PRIORITY);
-            
-            // Set machine to maximum performance
-            MachineInfo_t machineInfo = Machine_GetInfo(taskMachine);
-            for (unsigned i = 0; i < machineInfo.num_cpus; i++) {
-                Machine_SetCorePerformance(taskMachine, i, P0);
-            }
-            
-            // If the machine is overloaded, try to reduce load
-            if (machineInfo.active_tasks > machineInfo.num_cpus) {
-                VMInfo_t vmInfo = VM_GetInfo(taskVM);
-                
-                // First try to move other tasks away from this VM
-                for (TaskId_t otherTask : vmInfo.active_tasks) {
-                    if (otherTask == task_id || RequiredSLA(otherTask) == SLA0) continue;
-                    
-                    // Find another VM for this task
-                    VMId_t targetVM = VMId_t(-1);
-                    for (VMId_t otherVM : scheduler.GetVMs()) {
-                        if (otherVM == taskVM || scheduler.IsVMMigrating(otherVM)) continue;
-                        
-                        VMInfo_t otherVMInfo = VM_GetInfo(otherVM);
-                        if (otherVMInfo.cpu == vmInfo.cpu) {
-                            targetVM = otherVM;
-                            break;
-                        }
-                    }
-                    
-                    if (targetVM != VMId_t(-1)) {
-                        // Move the non-SLA0 task to another VM
-                        Priority_t priority;
-                        SLAType_t otherSlaType = RequiredSLA(otherTask);
-                        switch (otherSlaType) {
-                            case SLA1: priority = MID_PRIORITY; break;
-                            case SLA2: priority = LOW_PRIORITY; break;
-                            default: priority = LOW_PRIORITY; break;
-                        }
-                        
-                        if (scheduler.SafeRemoveTask(taskVM, otherTask)) {
-                            VM_AddTask(targetVM, otherTask, priority);
-                            break;
-                        }
-                    }
-                }
-                
-                // If still overloaded, try to migrate this VM
-                MachineInfo_t updatedInfo = Machine_GetInfo(taskMachine);
-                if (updatedInfo.active_tasks > updatedInfo.num_cpus) {
-                    CPUType_t vmCpuType = vmInfo.cpu;
-                    MachineId_t targetMachine = MachineId_t(-1);
-                    
-                    // Find a less loaded machine
-                    for (MachineId_t machine : scheduler.GetMachines()) {
-                        if (machine == taskMachine) continue;
-                        if (!scheduler.IsMachineActive(machine)) continue;
-                        
-                        MachineInfo_t info = Machine_GetInfo(machine);
-                        if (info.cpu != vmCpuType) continue;
-                        
-                        if (info.active_tasks < machineInfo.active_tasks / 2) {
-                            targetMachine = machine;
-                            break;
-                        }
-                    }
-                    
-                    // If no suitable active machine, power on a new one
-                    if (targetMachine == MachineId_t(-1)) {
-                        for (MachineId_t machine : scheduler.GetMachines()) {
-                            if (scheduler.IsMachineActive(machine)) continue;
-                            
-                            MachineInfo_t info = Machine_GetInfo(machine);
-                            if (info.cpu != vmCpuType) continue;
-                            
-                            Machine_SetState(machine, S0);
-                            scheduler.ActivateMachine(machine);
-                            targetMachine = machine;
-                            break;
-                        }
-                    }
-                    
-                    // Perform migration
-                    if (targetMachine != MachineId_t(-1)) {
-                        scheduler.MarkVMAsMigrating(taskVM);
-                        VM_Migrate(taskVM, targetMachine);
-                    }
-                }
-            }
-        }
-        else if (slaType == SLA1) {
-            // For SLA1, take action but less aggressive than SLA0
-            SetTaskPriority(task_id, HIGH_PRIORITY);
-            
-            MachineInfo_t machineInfo = Machine_GetInfo(taskMachine);
-            for (unsigned i = 0; i < machineInfo.num_cpus; i++) {
-                Machine_SetCorePerformance(taskMachine, i, P0);
-            }
-            
-            // Only migrate if severely overloaded
-            if (machineInfo.active_tasks > machineInfo.num_cpus * 2) {
-                // Migration logic similar to SLA0 but with higher threshold
-                VMInfo_t vmInfo = VM_GetInfo(taskVM);
-                CPUType_t vmCpuType = vmInfo.cpu;
-                MachineId_t targetMachine = MachineId_t(-1);
-                
-                for (MachineId_t machine : scheduler.GetMachines()) {
-                    if (machine == taskMachine) continue;
-                    if (!scheduler.IsMachineActive(machine)) continue;
-                    
-                    MachineInfo_t info = Machine_GetInfo(machine);
-                    if (info.cpu != vmCpuType) continue;
-                    
-                    if (info.active_tasks < machineInfo.active_tasks / 2) {
-                        targetMachine = machine;
-                        break;
-                    }
-                }
-                
-                if (targetMachine == MachineId_t(-1)) {
-                    for (MachineId_t machine : scheduler.GetMachines()) {
-                        if (scheduler.IsMachineActive(machine)) continue;
-                        
-                        MachineInfo_t info = Machine_GetInfo(machine);
-                        if (info.cpu != vmCpuType) continue;
-                        
-                        Machine_SetState(machine, S0);
-                        scheduler.ActivateMachine(machine);
-                        targetMachine = machine;
-                        break;
-                    }
-                }
-                
-                if (targetMachine != MachineId_t(-1)) {
-                    scheduler.MarkVMAsMigrating(taskVM);
-                    VM_Migrate(taskVM, targetMachine);
-                }
-            }
-        }
-        else if (slaType == SLA2) {
-            // For SLA2, just increase priority
-            SetTaskPriority(task_id, HIGH_PRIORITY);
-        }
-    }
-}
\ No newline at end of file
+    ActivePolicy::SLAReaction::OnWarning(scheduler, time, task_id);
+    scheduler.FlushPerformance();
+}
@@ -6,70 +6,677 @@
 #ifndef Scheduler_hpp
 #define Scheduler_hpp
 
+#include <array>
+#include <cstdint>
 #include <vector>
 #include <map>
 #include <set>
+#include <unordered_map>
+#include <queue>
+#include <functional>
+#include <fstream>
 #include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 #include "Interfaces.h"
 #include "SimTypes.h"
 
+// Marks a P-state that is unknown (after a power transition) or not requested
+#define P_UNKNOWN CPUPerformance_t(P_STATES)
+
+#ifdef SCHEDULER_PROFILE
+// Simulator calls counted by a -DSCHEDULER_PROFILE build and reported by SimulationComplete
+typedef enum {
+    CALL_MACHINE_GET_INFO,
+    CALL_VM_GET_INFO,
+    CALL_MACHINE_SET_CORE_PERFORMANCE,
+    CALL_VM_MIGRATE,
+    SIMULATOR_CALLS
+} SimulatorCall_t;
+extern std::array<uint64_t, SIMULATOR_CALLS> simulatorCalls;
+#define COUNT_CALL(call) (simulatorCalls[call]++)
+#else
+#define COUNT_CALL(call) ((void)0)
+#endif
+
+// Scheduler messages go through SCHED_LOG, which compares the level with the simulator's
+// verbosity before the message is built, so a message SimOutput would discard costs one
+// comparison rather than its string formatting
+extern unsigned logVerbosity;
+#define SCHED_LOG(level, message) \
+    do { if ((level) <= logVerbosity) SimOutput((message), (level)); } while (0)
+
+// Number of tasks of each SLA class hosted by a VM or a machine
+typedef std::array<unsigned, NUM_SLAS> SLACount_t;
+
+// Properties of a machine that never change, read once in Init so the hot paths
+// do not have to copy a full MachineInfo_t out of the simulator
+typedef struct {
+    unsigned num_cpus;
+    CPUType_t cpu;
+    unsigned memory_size;
+    bool gpus;
+    vector<unsigned> performance;
+    vector<unsigned> c_states;
+    vector<unsigned> p_states;
+    vector<unsigned> s_states;
+} MachineSpec_t;
+
+// Tunables a parameter sweep varies between runs. Each Scheduler carries its own copy, set
+// from the defaults below and the SCHEDULER_UNDERLOAD, SCHEDULER_OVERLOAD and
+// SCHEDULER_CONSOLIDATION_START environment variables when Init runs.
+typedef struct {
+    double underloadThreshold;    // Machines below this utilization are drained
+    double overloadThreshold;     // Share of a machine's cores placement fills
+    Time_t consolidationStart;    // No consolidation until the start-up burst has settled
+} SchedulerParams_t;
+
+const SchedulerParams_t DEFAULT_PARAMS = { 0.3, 0.8, 1000000 };
+
+// What the scheduler keeps about a task from placement to completion. The SLA and memory
+// are read from the simulator once, when the task is placed.
+typedef struct {
+    VMId_t vm;
+    SLAType_t sla;
+    unsigned memory;
+    Time_t riskCheckAt;   // Time of the task's live riskQueue entry
+    bool escalated;       // Raised to HIGH_PRIORITY while at risk, done only once
+    Priority_t priority;  // As last set by the scheduler
+    TaskId_t yieldingTo;  // The SLA0 task it was demoted for, or NO_TASK
+} TaskState_t;
+
+const TaskId_t NO_TASK = TaskId_t(-1);
+
+// What moving a VM is expected to cost: how long its tasks stall, and the energy of
+// holding both hosts in S0 meanwhile, in joules
+typedef struct {
+    Time_t duration;
+    double energy;
+} MigrationCost_t;
+
+// Exponentially weighted means of the memory (MB) and duration of finished migrations and
+// of their products, from which migration time is fitted against memory by least squares
+typedef struct {
+    double memory;
+    double duration;
+    double memorySquared;
+    double product;
+} MigrationFit_t;
+
+// Binary event log, on when SCHEDULER_EVENT_LOG names a file: one fixed-size record per
+// event in host byte order, printed as CSV by decode-events. A log starts with an
+// EVENT_LOG_START record holding EVENT_LOG_VERSION and the record size.
+typedef enum {
+    EVENT_LOG_START,            // version, record size
+    EVENT_TASK_PLACED,          // task, VM, machine
+    EVENT_TASK_PENDING,         // task, CPU type
+    EVENT_TASK_COMPLETED,       // task, VM
+    EVENT_SLA_WARNING,          // task, VM
+    EVENT_MEMORY_WARNING,       // machine
+    EVENT_VM_CREATED,           // VM, machine, VM type
+    EVENT_VM_RETIRED,           // VM, machine
+    EVENT_MIGRATION_STARTED,    // VM, source, destination
+    EVENT_MIGRATION_DONE,       // VM, source, destination
+    EVENT_S_STATE_REQUESTED,    // machine, S-state
+    EVENT_S_STATE_CONFIRMED,    // machine, S-state
+    EVENT_P_STATE_SET,          // machine, P-state
+    EVENT_TYPES
+} EventType_t;
+
+typedef struct {
+    uint64_t time;
+    uint32_t event;
+    uint32_t subject;
+    uint32_t arg0;
+    uint32_t arg1;
+} EventRecord_t;
+
+const uint32_t EVENT_LOG_VERSION = 1;
+
+// Records are appended to one buffer while a background thread writes out the other, so a
+// callback only waits on the file when the writer has fallen a whole buffer behind
+class EventLog {
+public:
+    ~EventLog() { Close(); }
+    bool Open(const string &file, bool append);
+    bool IsOpen() const { return fd >= 0; }
+    void Append(Time_t time, EventType_t event, uint32_t subject, uint32_t arg0, uint32_t arg1) {
+        filling.push_back(EventRecord_t{time, uint32_t(event), subject, arg0, arg1});
+        if (filling.size() == BUFFER_RECORDS) HandOff();
+    }
+    // Writes out every record appended so far and stops the writer thread
+    void Close();
+private:
+    static const size_t BUFFER_RECORDS = 8192;
+    void HandOff();
+    void Write();
+    int fd = -1;
+    std::vector<EventRecord_t> filling;
+    std::vector<EventRecord_t> writing;   // Owned by the writer while writePending is set
+    bool writePending = false;
+    bool stopping = false;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::thread writer;
+};
+
+// Tasks ordered by a time key, earliest first
+typedef std::priority_queue<std::pair<Time_t, TaskId_t>, std::vector<std::pair<Time_t, TaskId_t>>,
+                            std::greater<std::pair<Time_t, TaskId_t>>> TaskQueue_t;
+// Machines and VMs by when they next need looking at, earliest first
+typedef std::priority_queue<std::pair<Time_t, MachineId_t>, std::vector<std::pair<Time_t, MachineId_t>>,
+                            std::greater<std::pair<Time_t, MachineId_t>>> MachineQueue_t;
+typedef std::priority_queue<std::pair<Time_t, VMId_t>, std::vector<std::pair<Time_t, VMId_t>>,
+                            std::greater<std::pair<Time_t, VMId_t>>> VMQueue_t;
+
+// Calendar queue for timestamps that only move forward and rarely lie far ahead: entries
+// go into one of BUCKETS buckets of BUCKET_WIDTH microseconds by time, wrapping around, and
+// PopDue only scans the buckets that have come due since the last call. Buckets keep their
+// storage between uses, so steady-state pushes do not allocate.
+class CalendarQueue {
+public:
+    CalendarQueue() : buckets(BUCKETS), cursor(0), count(0) {}
+    void Push(Time_t at, TaskId_t task) {
+        // An entry already due goes in the first bucket the next PopDue looks at
+        buckets[(std::max(at, cursor) / BUCKET_WIDTH) % BUCKETS].push_back(std::make_pair(at, task));
+        count++;
+    }
+    // Moves every entry due by now into due, earliest first
+    void PopDue(Time_t now, std::vector<std::pair<Time_t, TaskId_t>> &due);
+    bool Empty() const { return count == 0; }
+private:
+    static const Time_t BUCKET_WIDTH = 1000;
+    static const unsigned BUCKETS = 1024;
+    std::vector<std::vector<std::pair<Time_t, TaskId_t>>> buckets;
+    Time_t cursor;  // Every entry before this time has been popped
+    size_t count;
+};
+
+// Holt (level plus trend) estimate of an arrival or departure rate in tasks per microsecond,
+// fed with the number of events counted since the previous update
+typedef struct {
+    unsigned count;
+    double level;
+    double trend;
+} RateEstimate_t;
+
+// Placement index for the GPU or the non-GPU machines of one CPU type. Active machines are
+// kept ordered by utilization (ties broken by id) and by id alone; powered-down machines by
+// the depth of their S-state, then id. First-fit and next-to-wake (shallowest sleeper
+// first) queries are logarithmic; best-fit and worst-fit walk in from the busiest host with
+// room or the idlest one and stop once no host further in can fit better.
+typedef struct {
+    std::set<std::pair<double, MachineId_t>> byUtilization;
+    std::set<MachineId_t> active;
+    std::set<std::pair<MachineState_t, MachineId_t>> inactive;
+} MachineTier_t;
+
+// All machines of one CPU type: tiers[true] holds the GPU machines, tiers[false] the rest,
+// and active the powered-on machines of both. wakeLatency holds the observed time to return
+// to S0 from each S-state; arrivals (by SLA and VM type) and departures drive demand forecasts.
+// Tasks that found no ready VM wait in pending, ordered by the latest time they can start
+// and still meet their deadline on the pool's fastest machine (peakMIPS). A task needing
+// more than largestMemory, less a VM's overhead, can never get a reservation on the pool.
+typedef struct {
+    std::array<MachineTier_t, 2> tiers;
+    std::set<MachineId_t> active;
+    std::array<double, S_STATES> wakeLatency;
+    std::map<std::pair<SLAType_t, VMType_t>, RateEstimate_t> arrivals;
+    RateEstimate_t departures;
+    TaskQueue_t pending;
+    double peakMIPS;
+    unsigned largestMemory;
+} MachinePool_t;
+
 class Scheduler {
 public:
     const std::vector<VMId_t>& GetVMs() const { return vms; }
     const std::vector<MachineId_t>& GetMachines() const { return machines; }
     bool IsMachineActive(MachineId_t machine) const { 
-        return activeMachines.find(machine) != activeMachines.end(); 
+        return machine < machineActive.size() && machineActive[machine]; 
     }
-    bool SafeRemoveTask(VMId_t vm, TaskId_t task);
-    void ActivateMachine(MachineId_t machine) {
-        activeMachines.insert(machine);
-        machineUtilization[machine] = 0.0;
+    void ActivateMachine(MachineId_t machine);
+    void DeactivateMachine(MachineId_t machine);
+    void UpdateUtilization(MachineId_t machine);
+    void SetMachineState(MachineId_t machine, MachineState_t s_state);
+    void ConfirmMachineState(MachineId_t machine, MachineState_t s_state, Time_t now);
+    bool IsMachineSettled(MachineId_t machine) const { return machineSettled[machine]; }
+    bool IsMachineAwake(MachineId_t machine) const { return machineSettled[machine] && machineSState[machine] == S0; }
+    bool IsMachineDraining(MachineId_t machine) const { return machineDraining[machine]; }
+    
+    // Machine-wide P-state requests are buffered and coalesced; FlushPerformance issues
+    // Machine_SetCorePerformance only for machines whose P-state actually changes
+    void SetMachinePerformance(MachineId_t machine, CPUPerformance_t p_state);
+    void FlushPerformance();
+    
+    // Machine queries over one CPU type; MachineId_t(-1) if none qualifies. The queries
+    // without a gpu argument look at both tiers.
+    const std::set<MachineId_t>& GetActiveMachines(CPUType_t cpu) { return machinePools[cpu].active; }
+    MachineId_t NextMachineToWake(CPUType_t cpu, bool gpu) const;
+    MachineId_t NextMachineToWake(CPUType_t cpu) const;
+    MachineId_t NextMachineToWake() const;
+    
+    VMId_t CreateVM(VMType_t vm_type, CPUType_t cpu, MachineId_t machine);
+    // Shuts down an idle VM and forgets it
+    void RetireVM(VMId_t vm);
+    void AttachVM(VMId_t vm, MachineId_t machine) {
+        VM_Attach(vm, machine);
+        vmsOnMachine[machine].insert(vm);
+        vmHost[vm] = machine;
+        machineMemory[machine] += vmMemory[vm];
     }
-    void DeactivateMachine(MachineId_t machine) {
-        activeMachines.erase(machine);
+    const std::set<VMId_t>& GetVMsOnMachine(MachineId_t machine) const {
+        return vmsOnMachine[machine];
     }
-    
-    void AddVM(VMId_t vm) {
-        vms.push_back(vm);
+    // The task's static properties come from the TaskInfo_t its placement was decided on.
+    // Each simulator getter validates its argument and costs about as much as a whole
+    // GetTaskInfo, so hot paths read a task once and use the scheduler's own tables after.
+    void AddTask(VMId_t vm, const TaskInfo_t &info, Priority_t priority) {
+        TaskId_t task = info.task_id;
+        VM_AddTask(vm, task, priority);
+        LogEvent(EVENT_TASK_PLACED, task, vm, vmHost[vm]);
+        TaskState_t &state = liveTasks[task];
+        state = TaskState_t{vm, info.required_sla, info.required_memory, RISK_UNTRACKED, false, priority, NO_TASK};
+        vmTasks[vm].push_back(task);
+        CountTask(vm, state.sla, +1);
+        ReserveMemory(vm, int(state.memory));
+        TrackSLARisk(task, Now());
+    }
+    // Tasks cannot be moved between VMs: the simulator keeps a task bound to the VM it
+    // was first added to and fails when it completes anywhere else. An SLA0 task at risk
+    // instead takes CPU share from the other tasks of its VM, except those already raised
+    // to HIGH_PRIORITY; they get their SLA's priority back when it completes.
+    void YieldToTask(VMId_t vm, TaskId_t task);
+    void SetPriority(TaskId_t task, Priority_t priority) {
+        liveTasks.at(task).priority = priority;
+        SetTaskPriority(task, priority);
+    }
+    VMId_t GetTaskVM(TaskId_t task) const {
+        auto it = liveTasks.find(task);
+        return it != liveTasks.end() ? it->second.vm : VMId_t(-1);
+    }
+    // SLA of a task the scheduler has placed and not yet seen complete
+    SLAType_t GetTaskSLA(TaskId_t task) const { return liveTasks.at(task).sla; }
+    // Whether the VM exists and has not been shut down, without asking the simulator
+    bool IsVMAlive(VMId_t vm) const { return vm < vmHost.size() && vmHost[vm] != MachineId_t(-1); }
+    MachineId_t GetVMMachine(VMId_t vm) const {
+        return vm < vmHost.size() ? vmHost[vm] : MachineId_t(-1);
+    }
+    CPUType_t GetVMCPU(VMId_t vm) const { return vmCPU[vm]; }
+    VMType_t GetVMType(VMId_t vm) const { return vmType[vm]; }
+    const std::vector<TaskId_t>& GetVMTasks(VMId_t vm) const { return vmTasks[vm]; }
+    unsigned GetVMTaskCount(VMId_t vm) const { return unsigned(vmTasks[vm].size()); }
+    const MachineSpec_t& GetMachineSpec(MachineId_t machine) const { return machineSpecs[machine]; }
+    CPUType_t GetMachineCPU(MachineId_t machine) const { return machineSpecs[machine].cpu; }
+    unsigned GetMachineCores(MachineId_t machine) const { return machineSpecs[machine].num_cpus; }
+    bool MachineHasGPU(MachineId_t machine) const { return machineSpecs[machine].gpus; }
+    unsigned GetMachineTaskCount(MachineId_t machine) const {
+        const SLACount_t &count = machineSLACount[machine];
+        return count[SLA0] + count[SLA1] + count[SLA2] + count[SLA3];
+    }
+    unsigned GetVMSLACount(VMId_t vm, SLAType_t sla) const { return vmSLACount[vm][sla]; }
+    bool VMHasSLA(VMId_t vm, SLAType_t sla) const { return GetVMSLACount(vm, sla) > 0; }
+    bool MachineHasSLA(MachineId_t machine, SLAType_t sla) const { return machineSLACount[machine][sla] > 0; }
+    // Memory reserved by placement: VM_MEMORY_OVERHEAD per VM plus its tasks' memory. A
+    // migrating VM is charged to both hosts until it lands.
+    unsigned GetVMMemory(VMId_t vm) const { return vmMemory[vm]; }
+    unsigned GetMachineMemory(MachineId_t machine) const { return machineMemory[machine]; }
+    bool FitsMemory(MachineId_t machine, unsigned memory) const {
+        return GetMachineMemory(machine) + memory <= machineSpecs[machine].memory_size;
+    }
+    // Share of the machine left, by the tighter of cores under the overload threshold and
+    // memory, once a task needing this much memory lands; negative when overcommitted
+    double Headroom(MachineId_t machine, unsigned memory) const;
+    // No machine at this utilization has more Headroom; none at FullUtilization has room
+    double MaxHeadroom(double utilization) const { return 1.0 - utilization / params.overloadThreshold; }
+    double FullUtilization() const { return params.overloadThreshold; }
+    void MigrateVM(VMId_t vm, MachineId_t machine, Time_t now) {
+        MarkVMAsMigrating(vm);
+        vmDestination[vm] = machine;
+        vmMigratedAt[vm] = now;
+        machineMemory[machine] += vmMemory[vm];
+        inboundMigrations[machine]++;
+        migrationsInFlight++;
+        MarkDirty(vmHost[vm]);
+        LogEvent(EVENT_MIGRATION_STARTED, vm, vmHost[vm], machine);
+        COUNT_CALL(CALL_VM_MIGRATE);
+#ifdef SCHEDULER_DEBUG
+        if (now != residueAt) migrationResidue.clear();
+        residueAt = now;
+        unsigned before = Machine_GetInfo(vmHost[vm]).active_tasks;
+        VM_Migrate(vm, machine);
+        migrationResidue[vm] = Machine_GetInfo(vmHost[vm]).active_tasks + GetVMTaskCount(vm) - before;
+#else
+        VM_Migrate(vm, machine);
+#endif
     }
     void MarkVMAsMigrating(VMId_t vm) {
-        migratingVMs.insert(vm);
+        vmMigrating[vm] = true;
     }
     
     void MarkVMAsReady(VMId_t vm) {
-        migratingVMs.erase(vm);
+        vmMigrating[vm] = false;
     }
     
     bool IsVMMigrating(VMId_t vm) const {
-        return migratingVMs.find(vm) != migratingVMs.end();
+        return vm < vmMigrating.size() && vmMigrating[vm];
     }
-    Scheduler() {}
+    // A VM can take tasks once it is not migrating and its host has confirmed S0
+    bool IsVMReady(VMId_t vm) const { return !IsVMMigrating(vm) && IsMachineAwake(vmHost[vm]); }
+    Scheduler() : params(DEFAULT_PARAMS) {}
     void Init();
+    void SampleEnergy(Time_t now);
+    // Adds a record to the event log, if there is one; the simulator clock is only read then
+    void LogEvent(EventType_t event, uint32_t subject, uint32_t arg0 = 0, uint32_t arg1 = 0) {
+        if (events.IsOpen()) events.Append(Now(), event, subject, arg0, arg1);
+    }
+    // What-if runs: once the simulation reaches SCHEDULER_FORK_AT, one child process per
+    // variant in SCHEDULER_FORK_VARIANTS carries on from the same state with its own tunables
+    void ForkVariants(Time_t now);
+    void WaitForVariants();
     void MigrationComplete(Time_t time, VMId_t vm_id);
     void NewTask(Time_t now, TaskId_t task_id);
+    bool PlaceTask(const TaskInfo_t &info);
+    // Whether some machine of the CPU type could hold the task's memory and a new VM
+    bool CanEverFit(CPUType_t cpu, unsigned memory) const {
+        auto it = machinePools.find(cpu);
+        return it != machinePools.end() && memory + VM_MEMORY_OVERHEAD <= it->second.largestMemory;
+    }
+    // What the placement policies choose from: the live VMs of a (CPU, VM type) and the
+    // machines of a GPU tier, nullptr when the cluster has none
+    const std::set<VMId_t>* GetVMPool(CPUType_t cpu, VMType_t vm_type) const;
+    const MachineTier_t* GetTier(CPUType_t cpu, bool gpu) const;
+    bool CanHostVM(MachineId_t machine) const { return vmsOnMachine[machine].size() < MAX_VMS_PER_HOST; }
+    bool HasRoom(MachineId_t machine) const {
+        return GetMachineTaskCount(machine) + 1 <= params.overloadThreshold * GetMachineCores(machine);
+    }
+    void ReclaimIdleVMs(Time_t now);
+    void AdmitPending(CPUType_t cpu);
     void PeriodicCheck(Time_t now);
     void Shutdown(Time_t now);
     void TaskComplete(Time_t now, TaskId_t task_id);
-    void MonitorSLA0Tasks(Time_t now);
-    void OptimizeForSLA0Tasks();
+    void MonitorSLATasks(Time_t now);
+    Time_t ProjectCompletion(TaskId_t task, Time_t now) const;
+    bool CanAffordMigration(VMId_t vm, Time_t now) const;
+    MigrationCost_t EstimateMigration(VMId_t vm, MachineId_t destination) const;
+    // Whether emptying source onto destinations saves more sleep energy than the moves cost
+    bool DrainPaysOff(MachineId_t source, const std::vector<VMId_t> &moving,
+                      const std::vector<MachineId_t> &destinations, Time_t now) const;
+    // Whether the task would finish sooner if its VM moved to the destination now, stall included
+    bool MigrationPays(VMId_t vm, TaskId_t task, MachineId_t destination, Time_t now) const;
+    // Asks for the VM hosting an at-risk task to move off its overloaded host. Requests are
+    // served together on the next tick, and only where the move beats staying put.
+    void RequestRelief(TaskId_t task) { reliefRequests.push_back(task); }
+    void RelieveHotSpots(Time_t now);
+    // The P-state, of those at which every resident task with an SLA still clears its risk
+    // margin, that finishes the machine's work for the least energy
+    CPUPerformance_t PlanPerformance(MachineId_t machine, Time_t now) const;
+    void PlanConsolidation(Time_t now);
+    void GovernPower(Time_t now);
+    void ForecastDemand(Time_t now);
+#ifdef SCHEDULER_DEBUG
+    // Full-cluster recompute, build with -DSCHEDULER_DEBUG to cross-check the incremental utilization
+    void VerifyUtilization(Time_t now);
+#endif
     
 private:
-    // Thresholds for underload/overload detection
-    const double UNDERLOAD_THRESHOLD = 0.3;  // 30% utilization
-    const double OVERLOAD_THRESHOLD = 0.8;   // 80% utilization
+    SchedulerParams_t params;
+    
+    // Energy time series, on when SCHEDULER_SAMPLE_FILE names a file: every
+    // SCHEDULER_SAMPLE_INTERVAL microseconds (DEFAULT_SAMPLE_INTERVAL when unset), one CSV
+    // row per machine with its energy, utilization and power state
+    const Time_t DEFAULT_SAMPLE_INTERVAL = 100000;
+    std::ofstream samples;
+    string sampleFile;
+    Time_t sampleInterval = 0;
+    Time_t nextSampleAt = 0;
+    
+    EventLog events;
+    string eventFile;
+    
+    // Variants are underload:overload:consolidation_start, comma-separated, a field left
+    // empty keeping this run's value. Child i writes its report to <SCHEDULER_FORK_OUTPUT>.i.
+    const Time_t NO_FORK = Time_t(-1);
+    const Time_t DEFAULT_FORK_AT = 0;
+    Time_t forkAt = NO_FORK;
+    string forkVariants;
+    string forkOutput;
+    std::vector<int> forkedVariants;
     
-    // Track machine utilization
-    std::map<MachineId_t, double> machineUtilization;
+    // A task is at risk once its projected slack falls below this share of its SLA window
+    const double SLA_RISK_SLACK = 0.1;
+    const Time_t RISK_RECHECK_LIMIT = 1000000;  // Re-project every task at least once a second
+    const Time_t RISK_UNTRACKED = Time_t(-1);
     
-    // Track which machines are powered on
-    std::set<MachineId_t> activeMachines;
+    // Consolidation starts at params.consolidationStart, keeps at most this many VMs in
+    // flight, and puts every machine it empties into DRAINED_STATE
+    const unsigned MAX_CONCURRENT_MIGRATIONS = 4;
+    const MachineState_t DRAINED_STATE = S0i1;
+    // A migrating VM's tasks make no progress; a VM only moves if every task with an SLA can
+    // absorb its expected migration time. That is fitted against the VM's memory from the
+    // measured migrations, starting from one DEFAULT_MIGRATION_LATENCY sample of an empty VM.
+    // The simulator's migrations take about 30 s whatever their size, so the per-MB term
+    // stays close to zero there.
+    const double DEFAULT_MIGRATION_LATENCY = 30000000;
+    const double MIGRATION_LATENCY_WEIGHT = 0.5;
+    MigrationFit_t migrationFit = {0.0, DEFAULT_MIGRATION_LATENCY, 0.0, 0.0};
+    Time_t MigrationDuration(unsigned memory) const;
+    std::vector<TaskId_t> reliefRequests;
+    
+    // Idle machines step down this ladder once they have been idle in their current state
+    // longer than the break-even time of the next one, as long as MIN_WARM_MACHINES of each
+    // CPU type stay awake. Wake latencies start from what the simulator's transition table
+    // produces (60 ms per table unit) and follow the measured values after that.
+    const std::array<MachineState_t, 4> IDLE_LADDER = {{S0, S0i1, S3, S5}};
+    const unsigned MIN_WARM_MACHINES = 1;
+    // Machines unused at start-up are parked in SPARE_STATE, except for STANDBY_SPARES of
+    // each CPU type in STANDBY_STATE, which the demand forecast can wake within its horizon.
+    // Both step down the ladder from there; a wake-up from S5 takes 300 s.
+    const MachineState_t SPARE_STATE = S3;
+    const MachineState_t STANDBY_STATE = S2;
+    const unsigned STANDBY_SPARES = 4;
+    const std::array<double, S_STATES> DEFAULT_WAKE_LATENCY = {{0, 60000, 300000, 3000000, 6000000, 12000000, 300000000}};
+    const double WAKE_LATENCY_WEIGHT = 0.5;
+    // Machine_GetInfo does not report S-state power, so break-even times use this profile
+    // (the common shape of the machine classes in Input.md)
+    const std::vector<unsigned> DEFAULT_S_STATE_POWER = {120, 100, 100, 80, 40, 10, 0};
+    const Time_t NOT_IDLE = Time_t(-1);
+    
+    // VMs are reused per (CPU, VM type); a host runs at most MAX_VMS_PER_HOST of them and
+    // a VM left without tasks for VM_IDLE_TIMEOUT is shut down
+    const unsigned MAX_VMS_PER_HOST = 4;
+    const Time_t VM_IDLE_TIMEOUT = 1000000;
+    
+    // Demand forecasting: smoothing weights for the rate level and trend, the shortest interval
+    // rates are measured over (PeriodicCheck also runs on StateChangeComplete), how far ahead the
+    // forecast may look, and how many machines it may wake per check. Sleepers that cannot
+    // be up within the horizon are not woken by the forecast.
+    const double RATE_LEVEL_WEIGHT = 0.5;
+    const double RATE_TREND_WEIGHT = 0.3;
+    const Time_t FORECAST_INTERVAL = 60000;     // The SchedulerCheck period
+    const Time_t FORECAST_HORIZON_LIMIT = 5000000;
+    const unsigned FORECAST_MAX_WAKE = 2;
+    Time_t lastForecastAt = 0;
     
     // Lists of VMs and machines
     std::vector<VMId_t> vms;
     std::vector<MachineId_t> machines;
+    
+    // Per-machine state, indexed by MachineId_t (ids are handed out densely from 0)
+    std::vector<MachineSpec_t> machineSpecs;
+    std::vector<double> machineUtilization;
+    std::vector<bool> machineActive;
+    std::vector<std::set<VMId_t>> vmsOnMachine;
+    std::vector<SLACount_t> machineSLACount;
+    std::vector<unsigned> machineMemory;
+    
+    // machineSState is the last S-state requested; machineSettled is set once the simulator has
+    // confirmed it. idleSince is when the machine last went idle or settled, wake* track the
+    // wake-up in progress so its latency can be measured.
+    // A draining machine is out of the placement pools while its VMs migrate away.
+    std::vector<MachineState_t> machineSState;
+    std::vector<bool> machineSettled;
+    std::vector<Time_t> idleSince;
+    // Idle machines by when GovernPower can next take them a step down the ladder; a wake
+    // latency re-measured meanwhile only counts from that check on. powerCheckAt names a
+    // machine's live entry so superseded ones can be skipped; powerDue is scratch space.
+    MachineQueue_t powerChecks;
+    std::vector<Time_t> powerCheckAt;
+    std::vector<MachineId_t> powerDue;
+    void SchedulePowerCheck(MachineId_t machine, Time_t at) {
+        powerCheckAt[machine] = at;
+        powerChecks.push(std::make_pair(at, machine));
+    }
+    std::vector<Time_t> wakeRequestedAt;
+    std::vector<MachineState_t> wakeFrom;
+    std::vector<bool> machineDraining;
+    std::vector<unsigned> inboundMigrations;
+    unsigned migrationsInFlight = 0;
+    
+    std::map<CPUType_t, MachinePool_t> machinePools;
+    
+    // Last P-state issued to each machine's cores, and the requests buffered since the last flush
+    std::vector<CPUPerformance_t> machinePState;
+    std::vector<CPUPerformance_t> pendingPState;
+    std::vector<MachineId_t> pendingPMachines;
+    
+    // Per-VM state, indexed by VMId_t and grown as VMs are created
+    std::vector<MachineId_t> vmHost;
+    std::vector<CPUType_t> vmCPU;
+    std::vector<std::vector<TaskId_t>> vmTasks;
+    std::vector<SLACount_t> vmSLACount;
+    std::vector<unsigned> vmMemory;
+    std::vector<bool> vmMigrating;
+    std::vector<MachineId_t> vmDestination;
+    std::vector<Time_t> vmMigratedAt;
+#ifdef SCHEDULER_DEBUG
+    // VM_Migrate takes only some of a VM's tasks off the source's count at once; the rest
+    // go once the simulator's clock moves on. migrationResidue holds, per VM migrated at
+    // residueAt, how many the source still counts.
+    std::unordered_map<VMId_t, unsigned> migrationResidue;
+    Time_t residueAt = 0;
+#endif
+    std::vector<VMType_t> vmType;
+    std::vector<Time_t> vmIdleSince;
+    // Idle VMs by when their timeout runs out; an entry is live while vmIdleSince still matches
+    VMQueue_t vmReclaims;
+    
+    // Live VMs by CPU and VM type, in creation order
+    std::map<std::pair<CPUType_t, VMType_t>, std::set<VMId_t>> vmPools;
+    
+    // Running tasks only: an entry is made at placement and dropped at completion, so
+    // this grows with the tasks in flight rather than with the length of the workload
+    std::unordered_map<TaskId_t, TaskState_t> liveTasks;
+    
+    // SLA0-SLA2 tasks by the time their slack next needs checking. A task's riskCheckAt
+    // names its live entry so superseded ones can be skipped lazily; riskDue is scratch
+    // space for the entries that come due on a tick.
+    CalendarQueue riskQueue;
+    std::vector<std::pair<Time_t, TaskId_t>> riskDue;
+    void TrackSLARisk(TaskId_t task, Time_t at);
+    // Escalated tasks still at risk, by host. Their projection only moves when the host's
+    // load or P-state does, so they are looked at again once the host is dirty.
+    std::vector<std::vector<TaskId_t>> riskParked;
+    
+    // Machines whose tasks, SLA mix, P-state or power state changed since the last tick.
+    // PeriodicCheck only revisits these; tickMachines holds the ones taken for this tick.
+    std::vector<bool> machineDirty;
+    std::vector<MachineId_t> dirtyMachines;
+    std::vector<MachineId_t> tickMachines;
+    void MarkDirty(MachineId_t machine) {
+        if (machineDirty[machine]) return;
+        machineDirty[machine] = true;
+        dirtyMachines.push_back(machine);
+    }
+    
+    // SLA class counters and memory reservations are kept in step with liveTasks and vmTasks
+    void CountTask(VMId_t vm, SLAType_t sla, int delta);
+    void ReserveMemory(VMId_t vm, int delta);
+    void ForgetTask(VMId_t vm, TaskId_t task);
+    
+    // Pulls a machine out of placement so it can be emptied, or powers it down once it is
+    void DrainMachine(MachineId_t machine);
+    MachineTier_t &TierOf(MachineId_t machine) {
+        return machinePools[GetMachineCPU(machine)].tiers[MachineHasGPU(machine)];
+    }
+    void SleepMachine(MachineId_t machine);
+};
+
+// Scheduling policies. Each plug-in is a set of static functions called at one of the
+// Scheduler's decision points, and SchedulerPolicy bundles one plug-in per decision. The
+// bundle is fixed at compile time, so the chosen variant is inlined into the callbacks
+// with no virtual dispatch. Build with -DSCHEDULER_POLICY=<preset> to swap the default;
+// the Makefile has a simulator-<variant> target for each preset below.
 
-    std::set<VMId_t> migratingVMs;
+// Placement: the warm VM, or else the host for a new VM, that takes a task
+struct HeadroomPlacement {
+    // Busiest host with room, SLA0 tasks spread by Scheduler::Headroom (the default)
+    static VMId_t PickVM(const Scheduler &scheduler, CPUType_t cpu, VMType_t vm_type, SLAType_t sla,
+                         bool gpu, bool withinCapacity, unsigned memory);
+    static MachineId_t PickHost(const Scheduler &scheduler, CPUType_t cpu, SLAType_t sla,
+                                bool gpu, bool withinCapacity, unsigned memory);
 };
+struct FirstFitPlacement {
+    // Oldest VM, then lowest-numbered host, that has room
+    static VMId_t PickVM(const Scheduler &scheduler, CPUType_t cpu, VMType_t vm_type, SLAType_t sla,
+                         bool gpu, bool withinCapacity, unsigned memory);
+    static MachineId_t PickHost(const Scheduler &scheduler, CPUType_t cpu, SLAType_t sla,
+                                bool gpu, bool withinCapacity, unsigned memory);
+};
+
+// Power: what happens to machines that have gone idle
+struct LadderPower {
+    static void Govern(Scheduler &scheduler, Time_t now) { scheduler.GovernPower(now); }
+};
+struct AlwaysOnPower {
+    // Machines woken for demand stay on
+    static void Govern(Scheduler &, Time_t) {}
+};
+
+// Migration: periodic rebalancing, moving at-risk tasks off overloaded hosts, and the
+// reaction to a host running out of memory
+struct ConsolidatingMigration {
+    static void Rebalance(Scheduler &scheduler, Time_t now) { scheduler.PlanConsolidation(now); }
+    static void Relieve(Scheduler &scheduler, Time_t now) { scheduler.RelieveHotSpots(now); }
+    static void OnMemoryWarning(Scheduler &scheduler, Time_t now, MachineId_t machine);
+};
+struct NoMigration {
+    // Placement already reserves memory, so an overcommitted host is left to drain
+    static void Rebalance(Scheduler &, Time_t) {}
+    static void Relieve(Scheduler &, Time_t) {}
+    static void OnMemoryWarning(Scheduler &, Time_t, MachineId_t) {}
+};
+
+// SLA reaction: what SLAWarning does for a task that is still running, and what the
+// scheduler does the first time it projects a task to miss its SLA
+struct EscalatingSLAReaction {
+    // Raise priority, then shed load or migrate the VM for SLA0 and badly overloaded SLA1
+    static void OnWarning(Scheduler &scheduler, Time_t now, TaskId_t task);
+    // Raise priority; for SLA0 also shed load and ask to move the VM off an overloaded host
+    static void OnRisk(Scheduler &scheduler, Time_t now, TaskId_t task);
+};
+struct PriorityOnlySLAReaction {
+    static void OnWarning(Scheduler &scheduler, Time_t now, TaskId_t task);
+    static void OnRisk(Scheduler &scheduler, Time_t, TaskId_t task) { scheduler.SetPriority(task, HIGH_PRIORITY); }
+};
+
+template <class PlacementPolicy, class PowerPolicy, class MigrationPolicy, class SLAReactionPolicy>
+struct SchedulerPolicy {
+    typedef PlacementPolicy Placement;
+    typedef PowerPolicy Power;
+    typedef MigrationPolicy Migration;
+    typedef SLAReactionPolicy SLAReaction;
+};
+
+typedef SchedulerPolicy<HeadroomPlacement, LadderPower, ConsolidatingMigration, EscalatingSLAReaction> EnergyAwarePolicy;
+typedef SchedulerPolicy<FirstFitPlacement, LadderPower, ConsolidatingMigration, EscalatingSLAReaction> FirstFitPolicy;
+typedef SchedulerPolicy<HeadroomPlacement, AlwaysOnPower, NoMigration, PriorityOnlySLAReaction> AlwaysOnPolicy;
+
+#ifndef SCHEDULER_POLICY
+#define SCHEDULER_POLICY EnergyAwarePolicy
+#endif
+typedef SCHEDULER_POLICY ActivePolicy;
 
 #endif /* Scheduler_hpp */
\ No newline at end of file
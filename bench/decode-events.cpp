@@ -0,0 +1,41 @@
+//
+//  decode-events.cpp
+//  CloudSim
+//
+//  Prints an event log written with SCHEDULER_EVENT_LOG as CSV, one row per record
+//
+#include "Scheduler.hpp"
+#include <iostream>
+
+static const char *EVENT_NAMES[EVENT_TYPES] = {
+    "log_start", "task_placed", "task_pending", "task_completed", "sla_warning", "memory_warning",
+    "vm_created", "vm_retired", "migration_started", "migration_done", "s_state_requested",
+    "s_state_confirmed", "p_state_set"
+};
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        cerr << "Usage: " << argv[0] << " event_log" << endl;
+        return 1;
+    }
+    std::ifstream in(argv[1], std::ios::binary);
+    EventRecord_t record;
+    if (!in.read(reinterpret_cast<char *>(&record), sizeof(record)) || record.event != EVENT_LOG_START ||
+        record.subject != EVENT_LOG_VERSION || record.arg0 != sizeof(record)) {
+        cerr << argv[1] << ": not a version " << EVENT_LOG_VERSION << " event log" << endl;
+        return 1;
+    }
+    
+    cout << "time_us,event,subject,arg0,arg1\n";
+    while (in.read(reinterpret_cast<char *>(&record), sizeof(record))) {
+        cout << record.time << ',';
+        if (record.event < EVENT_TYPES) cout << EVENT_NAMES[record.event];
+        else cout << record.event;
+        cout << ',' << record.subject << ',' << record.arg0 << ',' << record.arg1 << '\n';
+    }
+    if (in.gcount() != 0) {
+        cerr << argv[1] << ": ends in a partial record" << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,57 @@
+#!/bin/bash
+#
+# Runs each workload through a simulator built with -DSCHEDULER_BENCH and appends one
+# CSV row per workload to the results file, tagged with the commit and policy, so runs
+# can be compared across commits.
+#
+# With BENCH_SAMPLES set to a directory, each run also writes its per-machine energy time
+# series to <directory>/<workload>.csv, sampled every SCHEDULER_SAMPLE_INTERVAL microseconds.
+#
+# Usage: bench/run.sh <simulator> <results.csv> <policy> <workload.md>...
+
+if [ $# -lt 4 ]; then
+    echo "usage: $0 <simulator> <results.csv> <policy> <workload.md>..." >&2
+    exit 2
+fi
+simulator=$1
+results=$2
+policy=$3
+shift 3
+
+commit=$(git rev-parse --short HEAD 2>/dev/null || echo unknown)
+# A trailing + marks a scheduler with uncommitted changes
+git diff --quiet HEAD -- Scheduler.cpp Scheduler.hpp 2>/dev/null || commit="$commit+"
+date=$(date -u +%Y-%m-%dT%H:%M:%SZ)
+
+if [ ! -s "$results" ]; then
+    echo "date,commit,policy,workload,status,sla0_pct,sla1_pct,sla2_pct,energy_kwh,simulated_s,wall_s,cpu_s,scheduler_wall_s,scheduler_cpu_s" > "$results"
+fi
+
+output=$(mktemp)
+timing=$(mktemp)
+trap 'rm -f "$output" "$timing"' EXIT
+TIMEFORMAT='%R %U %S'
+
+printf '%-22s %8s %8s %8s %10s %10s %8s %10s\n' workload SLA0% SLA1% SLA2% energy simulated wall scheduler
+[ -z "$BENCH_SAMPLES" ] || mkdir -p "$BENCH_SAMPLES" || exit 1
+for workload in "$@"; do
+    [ -z "$BENCH_SAMPLES" ] || export SCHEDULER_SAMPLE_FILE="$BENCH_SAMPLES/$(basename "$workload" .md).csv"
+    { time "$simulator" "$workload" > "$output" 2>&1 ; } 2> "$timing"
+    read wall user sys < "$timing"
+    cpu=$(awk -v u="$user" -v s="$sys" 'BEGIN { printf "%.3f", u + s }')
+
+    field() { sed -n "s/$1/\1/p" "$output" | tail -1; }
+    sla0=$(field '^SLA0: \(.*\)%$')
+    sla1=$(field '^SLA1: \(.*\)%$')
+    sla2=$(field '^SLA2: \(.*\)%$')
+    energy=$(field '^Total Energy \(.*\)KW-Hour$')
+    simulated=$(field '^Simulation run finished in \(.*\) seconds$')
+    schedulerWall=$(field '^Scheduler time \(.*\) seconds wall.*$')
+    schedulerCPU=$(field '^Scheduler time .* seconds wall, \(.*\) seconds CPU$')
+    status=ok
+    [ -n "$simulated" ] || status=failed
+
+    echo "$date,$commit,$policy,$(basename "$workload" .md),$status,$sla0,$sla1,$sla2,$energy,$simulated,$wall,$cpu,$schedulerWall,$schedulerCPU" >> "$results"
+    printf '%-22s %8s %8s %8s %10s %10s %8s %10s\n' "$(basename "$workload" .md)" "${sla0:--}" "${sla1:--}" "${sla2:--}" \
+        "${energy:--}" "${simulated:--}" "$wall" "${schedulerWall:-$status}"
+done
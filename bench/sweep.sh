@@ -0,0 +1,57 @@
+#!/bin/bash
+#
+# Runs a workload once per combination of scheduler tunables and appends one CSV row per
+# run to the results file. The simulator keeps its machine, VM and task tables in process
+# globals, so every run is its own process; JOBS of them (default: one per core) run at
+# once. The grids are space-separated lists in UNDERLOAD, OVERLOAD and CONSOLIDATION_START.
+#
+# Usage: bench/sweep.sh <simulator> <results.csv> <workload.md>
+
+if [ $# -ne 3 ]; then
+    echo "usage: $0 <simulator> <results.csv> <workload.md>" >&2
+    exit 2
+fi
+simulator=$1
+results=$2
+workload=$3
+UNDERLOAD=${UNDERLOAD:-0.2 0.3 0.4}
+OVERLOAD=${OVERLOAD:-0.7 0.8 0.9}
+CONSOLIDATION_START=${CONSOLIDATION_START:-500000 1000000 2000000}
+JOBS=${JOBS:-$(nproc)}
+
+commit=$(git rev-parse --short HEAD 2>/dev/null || echo unknown)
+git diff --quiet HEAD -- Scheduler.cpp Scheduler.hpp 2>/dev/null || commit="$commit+"
+date=$(date -u +%Y-%m-%dT%H:%M:%SZ)
+
+if [ ! -s "$results" ]; then
+    echo "date,commit,workload,underload,overload,consolidation_start,status,sla0_pct,sla1_pct,sla2_pct,energy_kwh,simulated_s" > "$results"
+fi
+
+rows=$(mktemp -d)
+trap 'rm -rf "$rows"' EXIT
+
+# One run: the tunables come in as arguments and the row goes to a file of its own, so
+# concurrent runs never interleave their output
+run() {
+    local output
+    output=$(SCHEDULER_UNDERLOAD=$1 SCHEDULER_OVERLOAD=$2 SCHEDULER_CONSOLIDATION_START=$3 \
+             "$simulator" "$workload" 2>&1)
+    field() { sed -n "s/$1/\1/p" <<< "$output" | tail -1; }
+    local simulated status=ok
+    simulated=$(field '^Simulation run finished in \(.*\) seconds$')
+    [ -n "$simulated" ] || status=failed
+    echo "$date,$commit,$(basename "$workload" .md),$1,$2,$3,$status,$(field '^SLA0: \(.*\)%$'),$(field '^SLA1: \(.*\)%$'),$(field '^SLA2: \(.*\)%$'),$(field '^Total Energy \(.*\)KW-Hour$'),$simulated" \
+        > "$rows/$1-$2-$3"
+}
+export -f run
+export simulator workload commit date rows
+
+for underload in $UNDERLOAD; do
+    for overload in $OVERLOAD; do
+        for start in $CONSOLIDATION_START; do
+            echo "$underload $overload $start"
+        done
+    done
+done | xargs -P "$JOBS" -L 1 bash -c 'run "$@"' _
+
+sort -t, -k4,6 -g "$rows"/* | tee -a "$results"
@@ -0,0 +1,68 @@
+#!/bin/bash
+#
+# Turns a recorded arrival trace into a workload the simulator can replay. The machine
+# classes are copied from an existing workload, and every trace row becomes a task class
+# that yields exactly that one task at its recorded arrival. The trace is read one row at
+# a time, so it can be longer than memory.
+#
+# Init draws a class's arrivals and instruction count from its Seed. With SEED below the
+# first arrival lands FIRST_GAP microseconds after Start time when Inter arrival is
+# 1000000 (5 when it is 1000), and a task gets INSTRUCTIONS_PER_US instructions per
+# microsecond of Expected runtime, rounded to thousands. So Start time is set that far
+# before the arrival, End time one microsecond after Start time, and Expected runtime
+# from the recorded instructions. Arrivals before the fifth microsecond land on it.
+# Init computes instructions in 32 bits, so rows with more than 4294967295 are rejected.
+#
+# Trace columns, comma-separated, one task per row, an optional header row:
+#   arrival_us,instructions,memory_mb,vm_type,gpu,sla,cpu,task_type
+# e.g. 50000,3036890000,8,LINUX,no,SLA0,X86,WEB
+#
+# Usage: bench/trace2md.sh <machines.md> <trace.csv> > <workload.md>
+
+if [ $# -ne 2 ]; then
+    echo "usage: $0 <machines.md> <trace.csv> > <workload.md>" >&2
+    exit 2
+fi
+machines=$1
+trace=$2
+
+# Machine classes run from their header to the closing brace
+awk '/^machine class:/ { copy = 1 } copy { print } copy && /^}/ { copy = 0 }' "$machines" || exit 1
+
+awk -F, -v SEED=39 -v FIRST_GAP=5682 -v INSTRUCTIONS_PER_US=1214.756 '
+function fail(message) {
+    printf "%s:%d: %s\n", FILENAME, NR, message > "/dev/stderr"
+    failed = 1
+    exit 1
+}
+BEGIN {
+    split("LINUX LINUX_RT WIN AIX", list, " "); for (i in list) vm[list[i]] = 1
+    split("SLA0 SLA1 SLA2 SLA3", list, " "); for (i in list) sla[list[i]] = 1
+    split("ARM POWER RISCV X86", list, " "); for (i in list) cpu[list[i]] = 1
+    split("WEB CRYPTO STREAM AI HPC", list, " "); for (i in list) type[list[i]] = 1
+}
+{ sub(/\r$/, "") }
+NR == 1 && $1 !~ /^[0-9]+$/ { next }
+/^[ \t]*$/ { next }
+{
+    if (NF != 8) fail("expected 8 columns, found " NF)
+    if ($1 !~ /^[0-9]+$/ || $2 !~ /^[0-9]+$/ || $3 !~ /^[0-9]+$/) fail("arrival, instructions and memory must be integers")
+    if ($2 + 0 > 4294967295) fail("more than 4294967295 instructions")
+    if (!($4 in vm)) fail("unknown VM type " $4)
+    if ($5 != "yes" && $5 != "no") fail("GPU must be yes or no")
+    if (!($6 in sla)) fail("unknown SLA " $6)
+    if (!($7 in cpu)) fail("unknown CPU type " $7)
+    if (!($8 in type)) fail("unknown task type " $8)
+    gap = $1 >= FIRST_GAP ? FIRST_GAP : 5
+    mean = $1 >= FIRST_GAP ? 1000000 : 1000
+    start = $1 >= gap ? $1 - gap : 0
+    runtime = int($2 / INSTRUCTIONS_PER_US + 0.5)
+    if (runtime < 1) runtime = 1
+    printf "task class:\n{\n"
+    printf "        Start time: %d\n        End time : %d\n        Inter arrival: %d\n", start, start + 1, mean
+    printf "        Expected runtime: %d\n        Memory: %s\n        VM type: %s\n", runtime, $3, $4
+    printf "        GPU enabled: %s\n        SLA type: %s\n        CPU type: %s\n", $5, $6, $7
+    printf "        Task type: %s\n        Seed: %d\n}\n", $8, SEED
+}
+END { if (failed) exit 1 }
+' "$trace"